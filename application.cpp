@@ -4,6 +4,7 @@
 #include "network.hpp"
 #include "blockchain.hpp"
 #include "dispatcher.hpp"
+#include "picosha2.hpp"
 #include <boost/asio/signal_set.hpp>
 #include <boost/log/core.hpp>
 #include <boost/log/trivial.hpp>
@@ -16,10 +17,48 @@
 using bitchat::Application;
 namespace logging = boost::log::trivial;
 
+namespace
+{
+std::string toHex( const std::string & data )
+{
+    const auto begin{ reinterpret_cast<const unsigned char *>( data.data() ) };
+
+    return picosha2::bytes_to_hex_string( begin, begin + data.size() );
+}
+
+bitchat::Blockchain::Storage parseStorage( const std::string & storage )
+{
+    using Storage = bitchat::Blockchain::Storage;
+
+    if ( storage == "stream" )
+    {
+        return Storage::kStream;
+    }
+    else if ( storage == "mapped" )
+    {
+        return Storage::kMapped;
+    }
+    else if ( storage == "ring" )
+    {
+        return Storage::kRing;
+    }
+    else if ( storage == "memory" )
+    {
+        return Storage::kMemory;
+    }
+
+    throw std::invalid_argument( "Invalid storage - " + storage );
+}
+}
+
 void Application::run( const std::string name,
                        const std::string host,
                        const int port,
-                       const int reconnectTimeout )
+                       const int reconnectTimeout,
+                       const std::string storage,
+                       const std::size_t sendQueue,
+                       const std::uint8_t difficult,
+                       const bool archive )
 {
     BOOST_ASSERT( static_cast<uint16_t>( port ) == port );
 
@@ -34,9 +73,18 @@ void Application::run( const std::string name,
 
     try
     {
+        const auto kind{ parseStorage( storage ) };
         auto communication{ std::make_shared<Communication>() };
-        auto blockchain{ std::make_unique<Blockchain>( communication, name + ".blockchain" ) };
-        auto network{ std::make_unique<Network>( communication, host, port, reconnectTimeout ) };
+        //! Nothing of a chain kept in memory reaches the disk, there is nothing to flush
+        auto blockchain{ std::make_unique<Blockchain>( communication,
+                                                       name + ".blockchain",
+                                                       kind,
+                                                       kind == Blockchain::Storage::kMemory ?
+                                                           Blockchain::Sync::kNone :
+                                                           Blockchain::Sync::kBatch,
+                                                       archive,
+                                                       difficult ) };
+        auto network{ std::make_unique<Network>( communication, host, port, reconnectTimeout, sendQueue ) };
         auto console{ std::make_unique<Console>( communication ) };
         auto dispatcher{ std::make_unique<Dispatcher>( * console,
                                                        * network,
@@ -69,6 +117,103 @@ void Application::run( const std::string name,
     }
 }
 
+bool Application::verify( const std::string name,
+                          const std::uint8_t difficult )
+{
+    auto communication{ std::make_shared<Communication>() };
+    Blockchain blockchain{ communication,
+                           name + ".blockchain",
+                           Blockchain::Storage::kMapped,
+                           Blockchain::Sync::kNone,
+                           false,
+                           difficult };
+
+    blockchain.openReadOnly();
+    const auto broken{ blockchain.verify( 1 ) };
+    blockchain.close();
+
+    return broken == 0;
+}
+
+std::vector<std::uint64_t> Application::findKey( const std::string name,
+                                                 const std::string key )
+{
+    auto communication{ std::make_shared<Communication>() };
+    Blockchain blockchain{ communication,
+                           name + ".blockchain",
+                           Blockchain::Storage::kMapped,
+                           Blockchain::Sync::kNone,
+                           false,
+                           0 };
+
+    blockchain.open();
+    const auto result{ blockchain.findByKey( key ) };
+    blockchain.close();
+
+    return result;
+}
+
+std::vector<std::uint64_t> Application::findRange( const std::string name,
+                                                   const std::int64_t fromMs,
+                                                   const std::int64_t toMs )
+{
+    //! The time index is built from the blocks, nothing else is opened
+    auto communication{ std::make_shared<Communication>() };
+    Blockchain blockchain{ communication,
+                           name + ".blockchain",
+                           Blockchain::Storage::kMapped,
+                           Blockchain::Sync::kNone,
+                           false,
+                           0 };
+
+    blockchain.openReadOnly();
+    const auto result{ blockchain.findRange( fromMs, toMs ) };
+    blockchain.close();
+
+    return result;
+}
+
+bool Application::prove( const std::string name,
+                         const std::uint64_t index,
+                         std::string & root,
+                         std::string & proof )
+{
+    //! The accumulator is loaded by the full open
+    auto communication{ std::make_shared<Communication>() };
+    Blockchain blockchain{ communication,
+                           name + ".blockchain",
+                           Blockchain::Storage::kMapped,
+                           Blockchain::Sync::kNone,
+                           false,
+                           0 };
+    std::string rawBlock{};
+
+    blockchain.open();
+
+    const auto count{ blockchain.getHeadIndex() + 1 };
+
+    if ( index >= count )
+    {
+        blockchain.close();
+        throw std::runtime_error( "The block " + std::to_string( index ) + " isn't stored" );
+    }
+
+    //! The mapped storage reads right away
+    blockchain.readBlocks( index, 1, [ & rawBlock ]( const std::string & blocks ) {
+        rawBlock = blocks;
+    } );
+
+    const auto rawRoot{ blockchain.getRoot( count ) };
+    const auto rawProof{ blockchain.getProof( index, count ) };
+
+    blockchain.close();
+
+    root = toHex( rawRoot );
+    proof = toHex( rawProof );
+
+    return Blockchain::verifyProof( rawBlock, count, rawProof, rawRoot );
+}
+
 void Application::runPool( CommunicationPtr communication )
 {
     ThreadPool pool{ std::thread::hardware_concurrency() };
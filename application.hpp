@@ -4,6 +4,7 @@
 #include <vector>
 #include <memory>
 #include <thread>
+#include <cstdint>
 
 namespace bitchat {
 
@@ -21,7 +22,28 @@ public:
     static void run( const std::string name,
                      const std::string host,
                      const int port,
-                     const int reconnectTimeout );
+                     const int reconnectTimeout,
+                     const std::string storage,
+                     const std::size_t sendQueue,
+                     const std::uint8_t difficult,
+                     const bool archive );
+
+    static bool verify( const std::string name,
+                        const std::uint8_t difficult );
+
+    //! The queries open the chain of a stopped node, they load its indexes
+    static std::vector<std::uint64_t> findKey( const std::string name,
+                                               const std::string key );
+    static std::vector<std::uint64_t> findRange( const std::string name,
+                                                 const std::int64_t fromMs,
+                                                 const std::int64_t toMs );
+
+    //! Fills the hex root over the stored blocks and the proof of the block in it,
+    //! returns whether the proof verifies
+    static bool prove( const std::string name,
+                       const std::uint64_t index,
+                       std::string & root,
+                       std::string & proof );
 
 private:
     static void runPool( CommunicationPtr communication );
@@ -1,49 +1,140 @@
 #include "blockchain.hpp"
 #include "blockchain_block.hpp"
+#include "blockchain_keyindex.hpp"
+#include "blockchain_timeindex.hpp"
+#include "blockchain_hashcolumn.hpp"
+#include "blockchain_segment.hpp"
+#include "blockchain_archive.hpp"
+#include "blockchain_miner.hpp"
+#include "blockchain_accumulator.hpp"
+#include "blockchain_ring.hpp"
+#include "blockchain_iterator.hpp"
+#include "blockchain_valueheap.hpp"
+#include "hasher.hpp"
 #include "communication.hpp"
-#include <boost/asio/read.hpp>
-#include <boost/asio/write.hpp>
 #include <boost/log/trivial.hpp>
-#include <boost/filesystem/operations.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using bitchat::Blockchain;
 
-//namespace
-//{
+namespace
+{
 //constexpr auto kMaximumMessageSize{ 512 * 1024 * 1024 }; //! 512MB
-//}
+constexpr auto kSegmentBlocks{ 1024 * 1024 };
+constexpr auto kSyncInterval{ 1000 }; //! 1s
+constexpr auto kVerifyBatch{ 256 };
+constexpr auto kRecoveryBlocks{ 256 };
+constexpr auto kCheckpointBlocks{ 4096 };
+//! Format 2 appended a nonce and a difficulty to a block, format 1 ones are 9 bytes shorter and
+//! their hashes don't cover these fields, such a chain can't be converted but is synced anew
+constexpr auto kFormat{ 2 };
+constexpr std::size_t kFormerBlockSize{ sizeof( std::uint64_t ) + sizeof( std::uint8_t ) };
+constexpr auto kReceivedValues{ 256 };  //! values kept until the blocks referring to them arrive
+constexpr std::size_t kReceivedSize{ 64 * 1024 * 1024 };   //! 64MB, the most they take together
+constexpr auto kRangeValues{ kReceivedValues / 2 };    //! values sent ahead of a range, the asker keeps others too
+constexpr std::size_t kRangeValuesSize{ 1024 * 1024 };  //! 1MB of them, well below the 4MB send queue mark
+}
 const Blockchain::Event Blockchain::kOnSave{};
+constexpr char Blockchain::kNewBlock;
+constexpr std::uint64_t Blockchain::kRangeBlocks;
+constexpr std::uint64_t Blockchain::kRangeHeaders;
 
 Blockchain::Blockchain( const CommunicationPtr & communication,
-                        const std::string & path ) :
+                        const std::string & path,
+                        const Storage storage,
+                        const Sync sync,
+                        const bool archive,
+                        const std::uint8_t difficult ) :
     FileChannel{ communication },
     m_path{ path },
-    m_headIndex{ 0 }
+    m_storage{ storage },
+    m_sync{ sync },
+    m_archive{ archive && storage != Storage::kMemory },
+    m_difficult{ difficult },
+    m_readOnly{ false },
+    m_headIndex{ 0 },
+    m_count{ 0 },
+    m_segmentBlocks{ kSegmentBlocks },
+    m_verifiedCount{ 0 },
+    m_checkedCount{ 0 },
+    m_checkpointCount{ 0 },
+    m_checkpointValueTail{ 0 },
+    m_valueTail{ 0 },
+    m_receivedSize{ 0 },
+    m_commitScheduled{ false },
+    m_syncScheduled{ false },
+    m_syncTimer{ communication->getIos() },
+    m_miningStopped{ false },
+    m_archivingStopped{ false },
+    m_writing{ false }
 {
-//    m_headBlock->difficult = 0;
+    setHead( std::make_shared<Head>( Block{} ) );
+    publishLayout();
+    std::make_unique<KeyIndex>( getSidecarPath( ".keys" ) ).swap( m_keyIndex );
+    std::make_unique<TimeIndex>().swap( m_timeIndex );
+    std::make_unique<HashColumn>( getSidecarPath( ".hashes" ) ).swap( m_hashColumn );
+    std::make_unique<Accumulator>( getSidecarPath( ".mmr" ) ).swap( m_accumulator );
+    std::make_unique<ValueHeap>( getSidecarPath( ".values" ) ).swap( m_valueHeap );
+    std::make_unique<Miner>( std::thread::hardware_concurrency() ).swap( m_miner );
+    std::make_unique<Ring>( communication->getIos() ).swap( m_ring );
 }
 
-void Blockchain::open()
+Blockchain::~Blockchain()
 {
-    const auto flags{ boost::filesystem::exists( m_path ) ?
-                      O_RDWR | O_NONBLOCK :
-                      O_CREAT | O_RDWR | O_NONBLOCK };
+    stopMining();
+    stopArchiving();
+}
 
-    auto descriptor{ ::open( m_path.c_str(), flags, 0640 ) };
+void Blockchain::open()
+{
+    std::uint64_t valueTail{ 0 };
+    auto descriptor{ openFile( getSidecarPath( ".manifest" ), O_CREAT | O_RDWR | O_NONBLOCK ) };
 
     try
     {
-        bytes_readable command{};
-
         assign( descriptor );
         non_blocking( true );
-        io_control( command );
+        openSegments();
+
+        m_hashColumn->open();
+        m_accumulator->open();
+        const auto heapSize{ m_valueHeap->open() };
+        recoverTail();
+        updateHashColumn();
+        updateAccumulator();
+        updateKeyIndex();
+        loadCheckpoint();
 
-        m_headIndex = command.get() / getBlockSize();
+        //! An empty heap means the chain never referred to it, the blocks the checkpoint
+        //! covers don't have to be looked through
+        valueTail = heapSize > 0 ? findValueTail( m_checkpointCount, m_count, m_checkpointValueTail ) : 0;
+
+        if ( heapSize > valueTail )
+        {
+            BOOST_LOG_TRIVIAL( warning ) << "Dropped " << heapSize - valueTail << " bytes of values written for lost blocks";
+            m_valueHeap->truncate( valueTail );
+        }
+        else if ( heapSize < valueTail )
+        {
+            BOOST_LOG_TRIVIAL( error ) << "The value heap lacks " << valueTail - heapSize << " bytes of values";
+        }
+
+        m_headIndex = m_count;
 
         if ( m_headIndex > 0 )
         {
             --m_headIndex;
+            setHead( std::make_shared<Head>( loadBlock( m_headIndex ) ) );
         }
         else
         {
@@ -51,23 +142,155 @@ void Blockchain::open()
             block.key[ 0 ] = '@';
             saveBlock( block );
         }
+
+        checkpoint();
+
+        if ( m_storage == Storage::kRing && ! m_ring->open() )
+        {
+            BOOST_LOG_TRIVIAL( warning ) << "Falling back to synchronous blockchain storage";
+        }
     }
     catch ( ... )
     {
+        setHead( std::make_shared<Head>( Block{} ) );
+        m_keyIndex->close();
+        m_hashColumn->close();
+        m_accumulator->close();
+        m_valueHeap->close();
+        m_segments.clear();
+        m_count = 0;
+        publishLayout();
         ::close( descriptor );
-        ::remove( m_path.c_str() );
         throw;
     }
+    do
+    {
+        std::lock_guard<std::mutex> lock{ m_queueMutex };
+        m_tail = getHead();
+        m_valueTail = valueTail;
+    } while( false );
+
+    m_miner->reset();
+
+    //! Mining holds its thread for as long as a search lasts, so it stays off the io_service
+    if ( m_difficult > 0 )
+    {
+        m_miningStopped = false;
+        m_miningThread = std::thread{ & Blockchain::mine, this };
+    }
+
+    //! Compressing a segment takes long, it is done aside and the archive swapped in when ready
+    if ( m_archive )
+    {
+        std::lock_guard<std::mutex> lock{ m_archiveMutex };
+
+        m_unarchived.clear();
+        m_archivingStopped = false;
+
+        for ( auto number{ 0ull }; number < m_segments.size(); ++number )
+        {
+            if ( m_segments[ number ]->isSealed() && ! m_segments[ number ]->isArchived() )
+            {
+                m_unarchived.push_back( number );
+            }
+        }
+
+        m_archiveThread = std::thread{ & Blockchain::archive, this };
+    }
+
     getCommunication()->notify( kOnOpen, this );
     BOOST_LOG_TRIVIAL( debug ) << "The blockhain opened";
 }
 
+void Blockchain::openReadOnly()
+{
+    //! A chain without a manifest is a single segment
+    const auto descriptor{ ::open( getSidecarPath( ".manifest" ).c_str(), O_RDONLY | O_NONBLOCK ) };
+
+    if ( descriptor < 0 && errno != ENOENT )
+    {
+        throwLastError( "Failed to open the blockchain manifest" );
+    }
+
+    m_readOnly = true;
+
+    try
+    {
+        if ( descriptor >= 0 )
+        {
+            assign( descriptor );
+        }
+
+        openSegments();
+
+        if ( m_count > 0 )
+        {
+            m_headIndex = m_count - 1;
+            setHead( std::make_shared<Head>( loadBlock( m_headIndex ) ) );
+        }
+    }
+    catch ( ... )
+    {
+        m_segments.clear();
+        m_count = 0;
+        publishLayout();
+        m_readOnly = false;
+        FileChannel::close();
+        throw;
+    }
+
+    BOOST_LOG_TRIVIAL( debug ) << "The blockhain opened read-only";
+}
+
 void Blockchain::close()
 {
     getCommunication()->perform( kOnClose, this );
+
+    do
+    {
+        std::lock_guard<std::mutex> lock{ m_queueMutex };
+
+        if ( ! m_unmined.empty() )
+        {
+            BOOST_LOG_TRIVIAL( warning ) << "Dropped " << m_unmined.size() << " unmined blocks";
+            m_unmined.clear();
+        }
+
+        m_receivedValues.clear();
+        m_receivedSize = 0;
+        m_expectedHashes.clear();
+    } while( false );
+
+    stopMining();
+    stopArchiving();
+
+    //! Completes the writes in flight, the rest is committed synchronously
+    m_ring->close();
+    commit();
+    sync();
+    checkpoint();
+    m_syncTimer.cancel();
+    m_keyIndex->close();
+    m_timeIndex->reset();
+    m_hashColumn->close();
+    m_accumulator->close();
+    m_valueHeap->close();
+    m_verifiedCount = 0;
+    m_checkedCount = 0;
+
+    do
+    {
+        //! The blocks are read by their count, a chain opened read-only may have no manifest open
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        m_segments.clear();
+        m_count = 0;
+        publishLayout();
+    } while( false );
+
     FileChannel::close();
     m_headIndex = 0;
-    //    m_headBlock.reset();
+    m_readOnly = false;
+    setHead( std::make_shared<Head>( Block{} ) );
 }
 
 std::size_t Blockchain::getHeadIndex()
@@ -77,146 +300,1706 @@ std::size_t Blockchain::getHeadIndex()
 
 std::string Blockchain::getHeadHash()
 {
-    return Block::convertToString( getBlock( 0 ).calculateHash() );
+    return Block::convertToString( getHead()->hash );
 }
 
 std::string Blockchain::getHeadKey()
 {
-    return Block::convertToString( getBlock( 0 ).key );
+    return Block::convertToString( getHead()->block.key );
 }
 
 std::string Blockchain::getHeadValue()
 {
-    return Block::convertToString( getBlock( 0 ).value );
+    return loadValue( getHead()->block );
 }
 
 std::int64_t Blockchain::getHeadTimestamp()
 {
-    return getBlock( 0 ).timestamp;
+    return getHead()->block.timestamp;
 }
 
-void Blockchain::save( const std::string & rawBlock )
+std::string Blockchain::getKey( const std::uint64_t index )
 {
-    const auto block{ convertBlock( rawBlock ) };
+    return Block::convertToString( getBlock( index ).key );
+}
 
-    saveBlock( block );
-    m_headIndex = block.index;
-    getCommunication()->notify( kOnSave, this );
+std::string Blockchain::getValue( const std::uint64_t index )
+{
+    return loadValue( getBlock( index ) );
 }
 
-void Blockchain::store( const std::string & key,
-                        const std::string & value )
+std::int64_t Blockchain::getTimestamp( const std::uint64_t index )
 {
-    BOOST_ASSERT( ! key.empty() );
-    BOOST_ASSERT( ! value.empty() );
+    return getBlock( index ).timestamp;
+}
 
-    auto block = getBlock( 0 );
-    block.previousHash = block.calculateHash();
-    block.timestamp = Block::getCurrentTimestamp();
-    std::copy( key.begin(), key.end(), block.key.begin() );
-    std::copy( value.begin(), value.end(), block.value.begin() );
-    ++block.index;
+std::string Blockchain::getHash( const std::uint64_t index )
+{
+    const auto hash{ loadHash( index ) };
 
-    saveBlock( block );
-    m_headIndex = block.index;
-    getCommunication()->notify( kOnSave, this );
+    return picosha2::bytes_to_hex_string( hash.begin(), hash.end() );
 }
 
-std::string Blockchain::makeBlockRequest( const std::uint64_t index )
+bool Blockchain::hasBlock( const std::uint64_t index,
+                           const std::string & hash )
+{
+    do
+    {
+        std::lock_guard<std::mutex> lock{ m_queueMutex };
+
+        if ( index > m_tail->block.index )
+        {
+            return false;
+        }
+
+        for ( const auto & head : m_pending )
+        {
+            if ( head->block.index == index )
+            {
+                return hash == std::string{ head->hash.begin(), head->hash.end() };
+            }
+        }
+    } while( false );
+
+    //! A block neither queued nor committed is being written
+    if ( index >= getBlocksCount() )
+    {
+        return true;
+    }
+
+    return hash == loadHash( index );
+}
+
+std::string Blockchain::getRoot( const std::uint64_t count )
+{
+    const auto root{ m_accumulator->getRoot( count ) };
+
+    return std::string{ root.begin(), root.end() };
+}
+
+std::string Blockchain::getProof( const std::uint64_t index,
+                                  const std::uint64_t count )
 {
     std::string result{};
-    const auto begin{ reinterpret_cast<const char *>( & index ) };
-    const auto end{ begin + sizeof( index ) };
 
-    result.reserve( 1 + sizeof( index ) );
-    result += kRequestBlock;
-    result.append( begin, end );
+    for ( const auto & hash : m_accumulator->prove( index, count ) )
+    {
+        result.append( hash.begin(), hash.end() );
+    }
 
     return result;
 }
 
-std::string Blockchain::makeBlockResponse( const std::uint64_t index )
+bool Blockchain::verifyProof( const std::string & rawBlock,
+                              const std::uint64_t count,
+                              const std::string & proof,
+                              const std::string & root )
 {
-    const auto block{ getBlock( index ) };
-    return kResponseBlock + convertBlock( block );
+    //! Nothing is converted before every size is checked
+    if ( rawBlock.size() != getBlockSize() ||
+         proof.size() % getRootSize() != 0 ||
+         root.size() != getRootSize() )
+    {
+        return false;
+    }
+
+    const auto block{ convertBlock( rawBlock ) };
+    Accumulator::Proof hashes( proof.size() / getRootSize() );
+    Block::Sha256 expected{};
+
+    for ( auto i{ 0ull }; i < hashes.size(); ++i )
+    {
+        std::copy_n( proof.begin() + static_cast<std::ptrdiff_t>( i * getRootSize() ), getRootSize(), hashes[ i ].begin() );
+    }
+
+    std::copy( root.begin(), root.end(), expected.begin() );
+
+    return Accumulator::verify( block.calculateHash(), block.index, count, hashes, expected );
 }
 
-std::string Blockchain::makeNewBlock( const std::uint64_t index )
+std::uint64_t Blockchain::findFork( Fork & fork,
+                                    const std::uint64_t count,
+                                    const std::string & root )
 {
-    const auto block{ getBlock( index ) };
-    return kNewBlock + convertBlock( block );
+    //! The roots of equal prefixes are equal, so a binary search over the prefix
+    //! length finds the first differing block in O(log n) remote roots
+    if ( count > fork.same && count <= std::min( fork.different, m_accumulator->getCount() ) )
+    {
+        if ( root == getRoot( count ) )
+        {
+            fork.same = count;
+        }
+        else
+        {
+            fork.different = count;
+        }
+    }
+    else
+    {
+        //! A root outside of the bounds only shows the peer has fewer blocks
+        fork.different = std::min( fork.different, std::max( count, fork.same ) );
+    }
+
+    return fork.different - fork.same > 1 ? fork.same + ( fork.different - fork.same ) / 2 : 0;
 }
 
-std::uint64_t Blockchain::extractBlockIndex( const std::string & data )
+std::vector<std::uint64_t> Blockchain::findByKey( const std::string & key )
 {
-    return * reinterpret_cast<const std::uint64_t*>( data.data() );
+    return m_keyIndex->find( key );
 }
 
-std::size_t Blockchain::getBlockSize()
+std::vector<std::uint64_t> Blockchain::findRange( const std::int64_t fromMs,
+                                                  const std::int64_t toMs )
 {
-    return Block::getSize();
+    return m_timeIndex->find( fromMs, toMs, getBlocksCount(), [ this ]( const auto begin, const auto count, auto blocks ) {
+        return loadBlocks( begin, count, blocks );
+    } );
 }
 
-Blockchain::Block Blockchain::getBlock( const std::uint64_t index )
+std::uint64_t Blockchain::verify( const std::uint64_t from )
+{
+    //! Returns the index of the first block which doesn't link to its predecessor,
+    //! or zero when the chain starting from the given block is intact
+    const auto start{ std::chrono::steady_clock::now() };
+    const auto count{ getBlocksCount() };
+    const auto first{ std::max<std::uint64_t>( from, 1 ) };
+    auto result{ count };
+
+    if ( first < count )
+    {
+        const auto threads{ std::max( std::thread::hardware_concurrency(), 1u ) };
+        const auto step{ ( count - first + threads - 1 ) / threads };
+        std::vector<std::uint64_t> broken( threads, count );
+        std::vector<std::thread> pool{};
+
+        for ( auto i{ 0u }; i < threads; ++i )
+        {
+            const auto begin{ std::min( first + i * step, count ) };
+            const auto end{ std::min( begin + step, count ) };
+
+            pool.emplace_back( [ this, & broken, i, begin, end ]() {
+                const auto index{ verifyLinks( begin, end ) };
+
+                if ( index < end )
+                {
+                    broken[ i ] = index;
+                }
+            } );
+        }
+
+        for ( auto & thread : pool )
+        {
+            thread.join();
+        }
+
+        result = * std::min_element( broken.begin(), broken.end() );
+    }
+
+    const std::chrono::duration<double> elapsed{ std::chrono::steady_clock::now() - start };
+    const auto verified{ count > first ? count - first : 0 };
+
+    if ( verified > 0 )
+    {
+        BOOST_LOG_TRIVIAL( info ) << "Verified " << verified << " blocks with " << Hasher::getBackendName()
+                                  << " hashing in " << elapsed.count() << "s ("
+                                  << static_cast<std::uint64_t>( verified / std::max( elapsed.count(), 1e-9 ) )
+                                  << " blocks/s)";
+    }
+
+    if ( result < count )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "The blockchain is broken at block " << result;
+        return result;
+    }
+
+    if ( m_verifiedCount < count )
+    {
+        m_verifiedCount = count;
+    }
+
+    return 0;
+}
+
+std::uint64_t Blockchain::revalidate()
 {
-    return loadBlock( index == 0 ? getHeadIndex() : index );
+    //! Only the blocks written after the last successful verification are checked
+    return verify( m_verifiedCount );
 }
 
-Blockchain::Block Blockchain::loadBlock( const std::uint64_t index )
+void Blockchain::save( const std::string & rawBlock )
 {
-    Block result{};
+    const auto head{ std::make_shared<Head>( convertBlock( rawBlock ) ) };
+
+    ValueHeap::Reference reference{};
+
+    //! A block names its own difficulty, it must not ask for less work than this node does
+    if ( head->block.difficult < m_difficult ||
+         ! Miner::isSolved( head->hash, head->block.difficult ) )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Rejected block " << head->block.index << " without proof of work";
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock{ m_queueMutex };
+
+    //! Blocks the chain already has, or can't link yet, arrive from every neighbour
+    if ( m_tail->block.index + 1 != head->block.index || m_tail->hash != head->block.previousHash )
+    {
+        BOOST_LOG_TRIVIAL( trace ) << "Skipped block " << head->block.index << " which doesn't extend the chain";
+        return;
+    }
+
+    const auto expected{ m_expectedHashes.find( head->block.index ) };
+
+    if ( expected != m_expectedHashes.end() &&
+         expected->second != std::string{ head->hash.begin(), head->hash.end() } )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Rejected block " << head->block.index << " which differs from its header";
+        return;
+    }
+
+    m_expectedHashes.erase( m_expectedHashes.begin(), m_expectedHashes.upper_bound( head->block.index ) );
+
+    if ( ValueHeap::getReference( head->block.value, reference ) )
+    {
+        //! The value comes ahead of its block and must continue the heap of this chain
+        const std::string hash{ reference.hash.begin(), reference.hash.end() };
+        const auto value{ std::find_if( m_receivedValues.begin(), m_receivedValues.end(),
+                                        [ & hash ]( const std::pair<std::string, std::string> & received ) {
+            return received.first == hash;
+        } ) };
+
+        //! The reference moves the heap tail, it must describe the value exactly
+        if ( value == m_receivedValues.end() || reference.offset != m_valueTail ||
+             reference.length != value->second.size() || reference.length > kMaximumValueSize )
+        {
+            BOOST_LOG_TRIVIAL( warning ) << "Rejected block " << head->block.index << " without its value";
+            return;
+        }
+
+        append( std::make_shared<Head>( head->block, value->second ) );
+        m_receivedSize -= value->second.size();
+        m_receivedValues.erase( value );
+    }
+    else
+    {
+        append( head );
+    }
+
+    //! The local search for this index can't win anymore
+    m_miner->cancel( head->block.index );
+}
+
+void Blockchain::saveValue( const std::string & value )
+{
+    Block::Sha256 hash{};
+
+    Hasher::hash( value.data(), value.size(), hash.data() );
+
+    if ( value.size() > kReceivedSize )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Dropped a value of " << value.size() << " bytes";
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock{ m_queueMutex };
+
+    //! The values whose blocks didn't come are dropped first
+    while ( ! m_receivedValues.empty() &&
+            ( m_receivedValues.size() >= kReceivedValues || m_receivedSize + value.size() > kReceivedSize ) )
+    {
+        m_receivedSize -= m_receivedValues.front().second.size();
+        m_receivedValues.pop_front();
+    }
+
+    m_receivedValues.emplace_back( std::string{ hash.begin(), hash.end() }, value );
+    m_receivedSize += value.size();
+}
+
+std::uint64_t Blockchain::saveHeaders( const std::string & headers )
+{
+    const auto count{ headers.size() / sizeof( Header ) };
+    std::lock_guard<std::mutex> lock{ m_queueMutex };
+    auto index{ m_tail->block.index };
+    auto hash{ m_tail->hash };
+    std::uint64_t linked{ 0 };
+
+    //! Headers recorded before are replaced by the ones linked now, the blocks of the range
+    //! they announced either came or won't be asked for again
+    m_expectedHashes.clear();
+
+    for ( ; linked < count; ++linked )
+    {
+        Header header{};
+
+        std::memcpy( & header, headers.data() + linked * sizeof( Header ), sizeof( Header ) );
+
+        if ( header.index != index + 1 || header.previousHash != hash )
+        {
+            break;
+        }
+
+        index = header.index;
+        hash = header.hash;
+        m_expectedHashes[ index ] = std::string{ hash.begin(), hash.end() };
+    }
+
+    return linked;
+}
+
+void Blockchain::store( const std::string & key,
+                        const std::string & value )
+{
+    BOOST_ASSERT( ! key.empty() );
+    BOOST_ASSERT( ! value.empty() && value.size() <= getMaximumValueSize() );
 
-    if ( is_open() )
+    std::lock_guard<std::mutex> lock{ m_queueMutex };
+
+    if ( m_difficult == 0 )
+    {
+        append( std::make_shared<Head>( makeBlock( key, value ), value.size() > kValueSize ? value : std::string{} ) );
+    }
+    else
     {
-        const auto position{ static_cast<std::int64_t>( index * getBlockSize() ) };
+        m_unmined.emplace_back( key, value );
+        m_miningCondition.notify_one();
+    }
+}
+
+std::uint64_t Blockchain::getHashRate() const
+{
+    return m_miner->getHashRate();
+}
+
+std::string Blockchain::makeBlockRequest( const std::uint64_t index )
+{
+    std::string result{};
+    const auto begin{ reinterpret_cast<const char *>( & index ) };
+    const auto end{ begin + sizeof( index ) };
+
+    result.reserve( 1 + sizeof( index ) );
+    result += kRequestBlock;
+    result.append( begin, end );
+
+    return result;
+}
+
+std::string Blockchain::makeNewValue( const std::uint64_t index )
+{
+    return makeNewValue( getBlock( index ) );
+}
+
+std::string Blockchain::makeNewValue( const Block & block )
+{
+    ValueHeap::Reference reference{};
 
-        ::lseek64( native_handle(), position, SEEK_SET );
-        read( result.getRawPointer(), getBlockSize() );
+    if ( ! ValueHeap::getReference( block.value, reference ) )
+    {
+        return std::string{};
     }
 
+    std::string result{ makeBlockRequest( reference.length ) };
+
+    result.front() = kNewValue;
+    result += m_valueHeap->read( reference );
+
     return result;
 }
 
-void Blockchain::saveBlock( const Block & block )
+std::string Blockchain::makeRootRequest( const std::uint64_t count )
 {
-    write( block.getRawPointer(), getBlockSize() );
+    std::string result{ makeBlockRequest( count ) };
+
+    result.front() = kRequestRoot;
+
+    return result;
 }
 
-std::string Blockchain::convertBlock( const Block & block )
+std::string Blockchain::makeRootResponse( const std::uint64_t count )
 {
-    return std::string{ block.getRawPointer(), getBlockSize() };
+    //! The root is taken over the blocks both sides have, the count tells how many
+    const auto shared{ std::min( count, m_accumulator->getCount() ) };
+    std::string result{ makeBlockRequest( shared ) };
+
+    result.front() = kResponseRoot;
+    result += getRoot( shared );
+
+    return result;
 }
 
-Blockchain::Block Blockchain::convertBlock( const std::string & data )
+std::string Blockchain::makeInventory( const std::uint64_t index )
 {
-    Block result{};
+    std::string result{ makeBlockRequest( index ) };
 
-    std::copy( data.begin(), data.end(), result.getRawPointer() );
+    result.front() = kInventory;
+    result += loadHash( index );
 
     return result;
 }
 
-//void Blockchain::proofOfWork( Block & block )
-//{
-//    if ( block.difficult != 0 )
-//    {
-//        for ( auto found{ false }; ! found; ++ block.nonce )
-//        {
-//            auto hash{ block.calculateHash() };
-//            const auto predicate{ []( const auto byte )
-//            {
-//                    return byte != 0;
-//            } };
-//            BOOST_ASSERT( block.difficult < hash.size() );
-
-    //        std::cout << Block::convertHashToString( hash )
-    //                  << std::endl
-    //                  << std::endl;
-//            found = hash.end() == std::find_if( hash.begin(),
-//                                                hash.begin() + block.difficult,
-//                                                predicate );
-//        }
-//    }
-//}
+std::string Blockchain::makeHeadersRequest( const std::uint64_t index,
+                                           const std::uint64_t count )
+{
+    std::string result{ makeBlocksRequest( index, count ) };
 
+    result.front() = kRequestHeaders;
 
+    return result;
+}
+
+std::string Blockchain::makeHeadersResponse( const std::uint64_t index,
+                                            const std::uint64_t count )
+{
+    std::vector<Block> blocks( std::min( count, kRangeHeaders ) );
+    const auto loaded{ loadBlocks( index, blocks.size(), blocks.data() ) };
+    std::string result{ makeHeadersRequest( index, loaded ) };
+
+    result.front() = kResponseHeaders;
+    result.reserve( result.size() + loaded * sizeof( Header ) );
+
+    for ( auto i{ 0ull }; i < loaded; ++i )
+    {
+        Header header{ blocks[ i ].index, blocks[ i ].timestamp, blocks[ i ].previousHash, {} };
+
+        if ( ! m_hashColumn->get( index + i, header.hash ) )
+        {
+            header.hash = blocks[ i ].calculateHash();
+        }
+
+        result.append( reinterpret_cast<const char *>( & header ), sizeof( header ) );
+    }
+
+    return result;
+}
+
+std::string Blockchain::makeBlockResponse( const std::uint64_t index )
+{
+    const auto block{ getBlock( index ) };
+    return kResponseBlock + convertBlock( block );
+}
+
+void Blockchain::makeBlockResponse( const std::uint64_t index,
+                                    const ResponseHandler & handler )
+{
+    const auto head{ getHead() };
+    std::uint64_t count{ 1 };
+
+    if ( index == 0 || index == head->block.index )
+    {
+        handler( std::string( 1, kResponseBlock ), View{ head, head->block.getRawPointer() }, getBlockSize() );
+        return;
+    }
+
+    const auto view{ viewBlocks( index, count ) };
+
+    if ( view )
+    {
+        handler( std::string( 1, kResponseBlock ), view, getBlockSize() );
+        return;
+    }
+
+    readBlocks( index, 1, [ handler ]( const std::string & blocks ) {
+        handler( kResponseBlock + ( blocks.empty() ? convertBlock( Block{} ) : blocks ), View{}, 0 );
+    } );
+}
+
+std::string Blockchain::makeBlocksRequest( const std::uint64_t index,
+                                          const std::uint64_t count )
+{
+    std::string result{ makeBlockRequest( index ) };
+    const auto begin{ reinterpret_cast<const char *>( & count ) };
+    const auto end{ begin + sizeof( count ) };
+
+    result.front() = kRequestBlocks;
+    result.append( begin, end );
+
+    return result;
+}
+
+void Blockchain::makeBlocksResponse( const std::uint64_t index,
+                                     const std::uint64_t count,
+                                     const ResponseHandler & handler )
+{
+    //! The range stops at the end of a segment, the asker goes on from where it ends.
+    //! Blocks the store keeps in memory go out from there, the others are read
+    auto viewed{ std::min( count, kRangeBlocks ) };
+    const auto view{ viewBlocks( index, viewed ) };
+
+    if ( view )
+    {
+        makeBlocksResponse( index, view, viewed, handler );
+        return;
+    }
+
+    readBlocks( index, std::min( count, kRangeBlocks ), [ this, index, handler ]( const std::string & blocks ) {
+        const auto data{ std::make_shared<const std::string>( blocks ) };
+
+        makeBlocksResponse( index, View{ data, data->data() }, blocks.size() / getBlockSize(), handler );
+    } );
+}
+
+void Blockchain::makeBlocksResponse( const std::uint64_t index,
+                                     const View & blocks,
+                                     const std::uint64_t count,
+                                     const ResponseHandler & handler )
+{
+    //! The range ends before the block whose value wouldn't fit the window of the asker,
+    //! the first value always fits
+    std::vector<std::string> values{};
+    std::size_t valuesSize{ 0 };
+    Block block{};
+    auto sent{ 0ull };
+
+    for ( ; sent < count; ++sent )
+    {
+        std::memcpy( block.getRawPointer(), blocks.get() + sent * getBlockSize(), getBlockSize() );
+
+        auto value{ makeNewValue( block ) };
+
+        if ( value.empty() )
+        {
+            continue;
+        }
+
+        if ( values.size() == kRangeValues || valuesSize + value.size() > kRangeValuesSize )
+        {
+            break;
+        }
+
+        valuesSize += value.size();
+        values.push_back( std::move( value ) );
+    }
+
+    for ( auto & value : values )
+    {
+        handler( std::move( value ), View{}, 0 );
+    }
+
+    std::string response{ makeBlocksRequest( index, sent ) };
+
+    response.front() = kResponseBlocks;
+    handler( std::move( response ), blocks, sent * getBlockSize() );
+}
+
+void Blockchain::readBlocks( const std::uint64_t index,
+                             const std::uint64_t count,
+                             const BlocksHandler & handler )
+{
+    //! A range is read at once only within one segment, the handler is called
+    //! on the completion of the read or right away when it can't be submitted
+    const auto layout{ getLayout() };
+    const auto complete{ [ handler ]( const int result, const char * data ) {
+        const auto length{ static_cast<std::size_t>( std::max( result, 0 ) ) };
+
+        handler( std::string{ data, length - length % getBlockSize() } );
+    } };
+    std::uint64_t size{ 0 };
+
+    if ( index < layout->count )
+    {
+        size = std::min( { count, layout->count - index, m_segmentBlocks - index % m_segmentBlocks } );
+    }
+
+    if ( size > 0 && m_ring->isOpen() &&
+         layout->segments[ index / m_segmentBlocks ]->read( * m_ring, index % m_segmentBlocks, size, complete ) )
+    {
+        return;
+    }
+
+    std::string result( size * getBlockSize(), '\0' );
+
+    result.resize( loadBlocks( index, size, & result.front() ) * getBlockSize() );
+    handler( result );
+}
+
+Blockchain::View Blockchain::viewBlocks( const std::uint64_t index,
+                                        std::uint64_t & count )
+{
+    const auto layout{ getLayout() };
+
+    if ( index >= layout->count )
+    {
+        count = 0;
+        return View{};
+    }
+
+    count = std::min( { count, layout->count - index, m_segmentBlocks - index % m_segmentBlocks } );
+
+    return layout->segments[ index / m_segmentBlocks ]->view( index % m_segmentBlocks, count );
+}
+
+std::uint64_t Blockchain::extractBlockIndex( const std::string & data )
+{
+    return * reinterpret_cast<const std::uint64_t*>( data.data() );
+}
+
+std::size_t Blockchain::getBlockSize()
+{
+    return Block::getSize();
+}
+
+std::size_t Blockchain::getRootSize()
+{
+    return sizeof( Block::Sha256 );
+}
+
+std::size_t Blockchain::getMaximumValueSize()
+{
+    return ValueHeap::kEnabled && kMaximumValueSize > kValueSize ? kMaximumValueSize : kValueSize;
+}
+
+std::size_t Blockchain::getInventorySize()
+{
+    return sizeof( std::uint64_t ) + sizeof( Block::Sha256 );
+}
+
+std::size_t Blockchain::getHeaderSize()
+{
+    return sizeof( Header );
+}
+
+Blockchain::Block Blockchain::getBlock( const std::uint64_t index )
+{
+    const auto head{ getHead() };
+
+    return index == 0 || index == head->block.index ? head->block : loadBlock( index );
+}
+
+std::string Blockchain::loadHash( const std::uint64_t index )
+{
+    const auto head{ getHead() };
+    Block::Sha256 hash{};
+
+    if ( index == 0 || index == head->block.index )
+    {
+        hash = head->hash;
+    }
+    else if ( ! m_hashColumn->get( index, hash ) )
+    {
+        hash = loadBlock( index ).calculateHash();
+    }
+
+    return std::string{ hash.begin(), hash.end() };
+}
+
+std::string Blockchain::loadValue( const Block & block )
+{
+    ValueHeap::Reference reference{};
+
+    if ( ValueHeap::getReference( block.value, reference ) )
+    {
+        return m_valueHeap->read( reference );
+    }
+
+    return Block::convertToString( block.value );
+}
+
+Blockchain::HeadPtr Blockchain::getHead() const
+{
+    return std::atomic_load( & m_head );
+}
+
+void Blockchain::setHead( const HeadPtr & head )
+{
+    std::atomic_store( & m_head, head );
+}
+
+Blockchain::LayoutPtr Blockchain::getLayout() const
+{
+    return std::atomic_load( & m_layout );
+}
+
+void Blockchain::publishLayout()
+{
+    //! Expects m_mutex to be locked by the caller, the blocks counted are written already
+    std::atomic_store( & m_layout, LayoutPtr{ std::make_shared<Layout>( Layout{ m_segments, m_count } ) } );
+}
+
+void Blockchain::append( const HeadPtr & head )
+{
+    //! Expects m_queueMutex to be locked by the caller
+    ValueHeap::Reference reference{};
+
+    m_pending.emplace_back( head );
+    m_tail = head;
+
+    if ( ValueHeap::getReference( head->block.value, reference ) )
+    {
+        m_valueTail = reference.offset + reference.length;
+    }
+
+    if ( ! m_commitScheduled )
+    {
+        m_commitScheduled = true;
+        getCommunication()->doLater( * this, & Blockchain::commit );
+    }
+}
+
+Blockchain::Block Blockchain::makeBlock( const std::string & key,
+                                         const std::string & value ) const
+{
+    //! Expects m_queueMutex to be locked by the caller
+    auto block = m_tail->block;
+    block.previousHash = m_tail->hash;
+    block.timestamp = Block::getCurrentTimestamp();
+    block.key.fill( 0 );
+    block.value.fill( 0 );
+    block.nonce = 0;
+    block.difficult = m_difficult;
+    std::copy( key.begin(), key.end(), block.key.begin() );
+    ++block.index;
+
+    //! A value too long for the block goes to the heap right after the values before it
+    if ( value.size() > kValueSize )
+    {
+        block.value = ValueHeap::makeReference( m_valueTail, value );
+    }
+    else
+    {
+        std::copy( value.begin(), value.end(), block.value.begin() );
+    }
+
+    return block;
+}
+
+void Blockchain::mine()
+{
+    for ( ;; )
+    {
+        Block block{};
+
+        do
+        {
+            std::unique_lock<std::mutex> lock{ m_queueMutex };
+
+            m_miningCondition.wait( lock, [ this ]() { return m_miningStopped || ! m_unmined.empty(); } );
+
+            if ( m_miningStopped )
+            {
+                return;
+            }
+
+            block = makeBlock( m_unmined.front().first, m_unmined.front().second );
+        } while( false );
+
+        const auto mined{ m_miner->mine( block ) };
+        std::lock_guard<std::mutex> lock{ m_queueMutex };
+
+        //! When a competing block took the index meanwhile the record is mined again on the new tail,
+        //! a search cancelled by close leaves the loop at the wait above
+        if ( mined && ! m_unmined.empty() &&
+             m_tail->block.index + 1 == block.index && m_tail->hash == block.previousHash )
+        {
+            const auto value{ std::move( m_unmined.front().second ) };
+
+            m_unmined.pop_front();
+            append( std::make_shared<Head>( block, value.size() > kValueSize ? value : std::string{} ) );
+        }
+    }
+}
+
+void Blockchain::stopMining()
+{
+    do
+    {
+        std::lock_guard<std::mutex> lock{ m_queueMutex };
+        m_miningStopped = true;
+    } while( false );
+
+    m_miningCondition.notify_one();
+    m_miner->cancel( std::numeric_limits<std::uint64_t>::max() );
+
+    if ( m_miningThread.joinable() )
+    {
+        m_miningThread.join();
+    }
+}
+
+void Blockchain::archive()
+{
+    for ( ;; )
+    {
+        std::size_t number{ 0 };
+        SegmentPtr segment{};
+
+        do
+        {
+            std::unique_lock<std::mutex> lock{ m_archiveMutex };
+
+            m_archiveCondition.wait( lock, [ this ]() { return m_archivingStopped || ! m_unarchived.empty(); } );
+
+            if ( m_archivingStopped )
+            {
+                return;
+            }
+
+            number = m_unarchived.front();
+            m_unarchived.pop_front();
+        } while( false );
+
+        do
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            segment = m_segments[ number ];
+        } while( false );
+
+        try
+        {
+            //! The archived segment replaces the raw one, which the reads under way keep
+            //! open until they are done, its file is only unlinked
+            const auto archived{ std::make_shared<Segment>( getSegmentPath( number ), segment->getFirst(), m_storage ) };
+
+            segment->archive();
+            archived->open( true );
+
+            std::lock_guard<std::mutex> lock{ m_mutex };
+
+            m_segments[ number ] = archived;
+            publishLayout();
+            ::remove( getSegmentPath( number ).c_str() );
+            BOOST_LOG_TRIVIAL( info ) << "Archived the blockchain segment " << getSegmentPath( number );
+        }
+        catch ( const std::exception & exception )
+        {
+            BOOST_LOG_TRIVIAL( warning ) << "Kept the blockchain segment " << getSegmentPath( number )
+                                         << " raw - " << exception.what();
+        }
+    }
+}
+
+void Blockchain::stopArchiving()
+{
+    do
+    {
+        std::lock_guard<std::mutex> lock{ m_archiveMutex };
+        m_archivingStopped = true;
+    } while( false );
+
+    m_archiveCondition.notify_one();
+
+    if ( m_archiveThread.joinable() )
+    {
+        m_archiveThread.join();
+    }
+}
+
+void Blockchain::commit()
+{
+    std::unique_lock<std::mutex> lock{ m_mutex };
+    Batch batch{};
+
+    do
+    {
+        std::lock_guard<std::mutex> queueLock{ m_queueMutex };
+
+        //! A batch in flight commits the rest once its write completes
+        if ( ! m_writing )
+        {
+            batch.swap( m_pending );
+        }
+
+        m_commitScheduled = false;
+    } while( false );
+
+    if ( batch.empty() || ! is_open() )
+    {
+        batch.clear();
+    }
+    else if ( saveBlocks( batch ) )
+    {
+        //! The completion of the write finishes the commit
+        return;
+    }
+
+    finishCommit( batch, lock );
+}
+
+void Blockchain::completeBlocks( const Batch & batch )
+{
+    std::unique_lock<std::mutex> lock{ m_mutex };
+
+    m_count += batch.size();
+    publishLayout();
+    indexBlocks( batch );
+
+    do
+    {
+        std::lock_guard<std::mutex> queueLock{ m_queueMutex };
+        m_writing = false;
+
+        if ( ! m_pending.empty() && ! m_commitScheduled )
+        {
+            m_commitScheduled = true;
+            getCommunication()->doLater( * this, & Blockchain::commit );
+        }
+    } while( false );
+
+    finishCommit( batch, lock );
+}
+
+void Blockchain::finishCommit( const Batch & batch,
+                               std::unique_lock<std::mutex> & lock )
+{
+    if ( ! batch.empty() )
+    {
+        m_headIndex = batch.back()->block.index;
+        getCommunication()->notify( kOnSave, this );
+        BOOST_LOG_TRIVIAL( trace ) << "Committed " << batch.size() << " blocks";
+    }
+
+    const auto due{ m_count >= m_checkedCount + kCheckpointBlocks };
+
+    if ( due )
+    {
+        m_checkedCount = m_count;
+    }
+
+    lock.unlock();
+
+    if ( due )
+    {
+        checkpoint();
+    }
+}
+
+void Blockchain::sync()
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    m_syncScheduled = false;
+
+    if ( is_open() && ! m_segments.empty() )
+    {
+        m_segments.back()->sync();
+        m_valueHeap->sync();
+    }
+}
+
+void Blockchain::scheduleSync()
+{
+    //! Expects m_mutex to be locked by the caller
+    if ( ! m_syncScheduled )
+    {
+        m_syncScheduled = true;
+        m_syncTimer.expires_from_now( boost::posix_time::milliseconds{ kSyncInterval } );
+        m_syncTimer.async_wait( [ this ]( const auto & error ) {
+            if ( ! error )
+            {
+                sync();
+            }
+        } );
+    }
+}
+
+std::uint64_t Blockchain::getBlocksCount()
+{
+    return getLayout()->count;
+}
+
+std::uint64_t Blockchain::verifyLinks( const std::uint64_t begin,
+                                      const std::uint64_t end )
+{
+    //! The predecessor of the first block belongs to the previous range,
+    //! it is loaded again here so the ranges are checked independently
+    std::vector<Block> blocks( kVerifyBatch + 1 );
+    std::vector<Block::Sha256> hashes( kVerifyBatch + 1 );
+
+    for ( auto index{ begin }; index < end; index += kVerifyBatch )
+    {
+        const auto count{ std::min<std::uint64_t>( kVerifyBatch, end - index ) };
+
+        const auto loaded{ loadBlocks( index - 1, count + 1, blocks.data() ) };
+
+        std::fill( blocks.begin() + static_cast<std::ptrdiff_t>( loaded ), blocks.end(), Block{} );
+        Block::hashBlocks( blocks.data(), count + 1, hashes.data() );
+
+        for ( auto i{ 0ull }; i < count; ++i )
+        {
+            if ( blocks[ i + 1 ].previousHash != hashes[ i ] ||
+                 blocks[ i + 1 ].difficult < m_difficult ||
+                 ! Miner::isSolved( hashes[ i + 1 ], blocks[ i + 1 ].difficult ) )
+            {
+                return index + i;
+            }
+        }
+    }
+
+    return end;
+}
+
+std::uint64_t Blockchain::loadBlocks( const std::uint64_t begin,
+                                      const std::uint64_t count,
+                                      char * buffer )
+{
+    return loadBlocks( begin, count, reinterpret_cast<Block *>( buffer ) );
+}
+
+std::uint64_t Blockchain::loadBlocks( const std::uint64_t begin,
+                                      const std::uint64_t count,
+                                      Block * blocks )
+{
+    //! Returns the number of blocks loaded, the range is cut at the end of the chain
+    //! and read with one call per segment it spans
+    const auto layout{ getLayout() };
+    const auto end{ begin < layout->count ? begin + std::min( count, layout->count - begin ) : begin };
+    std::uint64_t loaded{ 0 };
+
+    while ( begin + loaded < end )
+    {
+        const auto index{ begin + loaded };
+        const auto size{ std::min( end - index, m_segmentBlocks - index % m_segmentBlocks ) };
+        const auto read{ layout->segments[ index / m_segmentBlocks ]->read( index % m_segmentBlocks, size, blocks + loaded ) };
+
+        loaded += read;
+
+        if ( read < size )
+        {
+            break;
+        }
+    }
+
+    return loaded;
+}
+
+Blockchain::Iterator Blockchain::begin( const std::uint64_t from )
+{
+    return Iterator{ * this, from };
+}
+
+Blockchain::Iterator Blockchain::end()
+{
+    return Iterator{ * this, getBlocksCount() };
+}
+
+Blockchain::Block Blockchain::loadBlock( const std::uint64_t index )
+{
+    Block result{};
+    const auto layout{ getLayout() };
+
+    if ( index < layout->count )
+    {
+        layout->segments[ index / m_segmentBlocks ]->read( index % m_segmentBlocks, result );
+    }
+
+    return result;
+}
+
+void Blockchain::saveBlock( const Block & block )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    saveBlocks( Batch{ std::make_shared<Head>( block ) } );
+}
+
+bool Blockchain::saveBlocks( const Batch & batch )
+{
+    //! Expects m_mutex to be locked by the caller, returns true when the blocks are
+    //! still being written and completeBlocks finishes the job
+    //! The values and the hashes go first so every block which reached the disk
+    //! has its value and a hash to be checked against
+    auto values{ false };
+
+    for ( const auto & head : batch )
+    {
+        ValueHeap::Reference reference{};
+
+        if ( ! head->value.empty() && ValueHeap::getReference( head->block.value, reference ) )
+        {
+            m_valueHeap->write( reference, head->value );
+            values = true;
+        }
+    }
+
+    if ( values && m_sync == Sync::kBatch )
+    {
+        m_valueHeap->sync();
+    }
+
+    for ( const auto & head : batch )
+    {
+        m_hashColumn->append( head->hash );
+    }
+
+    m_hashColumn->flush();
+
+    for ( const auto & head : batch )
+    {
+        m_accumulator->append( head->hash );
+    }
+
+    m_accumulator->flush();
+
+    if ( writeBlocks( batch ) )
+    {
+        return true;
+    }
+
+    for ( auto offset{ 0ull }; offset < batch.size(); )
+    {
+        if ( m_segments.back()->getCount() == m_segmentBlocks )
+        {
+            rollSegment();
+        }
+
+        const auto count{ std::min<std::uint64_t>( batch.size() - offset,
+                                                   m_segmentBlocks - m_segments.back()->getCount() ) };
+
+        m_segments.back()->append( batch.data() + offset, count );
+        m_count += count;
+        offset += count;
+    }
+
+    publishLayout();
+    indexBlocks( batch );
+
+    return false;
+}
+
+bool Blockchain::writeBlocks( const Batch & batch )
+{
+    //! Expects m_mutex to be locked by the caller, a batch which has to roll
+    //! the tail segment is written synchronously
+    auto & tail{ * m_segments.back() };
+    const auto complete{ [ this, batch ]( const int, const char * ) {
+        completeBlocks( batch );
+    } };
+
+    if ( ! m_ring->isOpen() || tail.getCount() + batch.size() > m_segmentBlocks )
+    {
+        return false;
+    }
+
+    do
+    {
+        std::lock_guard<std::mutex> queueLock{ m_queueMutex };
+        m_writing = true;
+    } while( false );
+
+    if ( tail.append( * m_ring, batch.data(), batch.size(), complete ) )
+    {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> queueLock{ m_queueMutex };
+    m_writing = false;
+
+    return false;
+}
+
+void Blockchain::indexBlocks( const Batch & batch )
+{
+    //! Expects m_mutex to be locked by the caller
+    for ( const auto & head : batch )
+    {
+        m_keyIndex->append( head->block );
+        m_timeIndex->append( head->block );
+    }
+
+    m_keyIndex->flush();
+    setHead( batch.back() );
+
+    if ( m_sync == Sync::kBatch )
+    {
+        m_segments.back()->sync();
+    }
+    else if ( m_sync == Sync::kPeriodic )
+    {
+        scheduleSync();
+    }
+}
+
+void Blockchain::openSegments()
+{
+    //! The manifest is a few "name value" lines, a missing one means a single segment.
+    //! A chain without a layout recorded is checked to have the one it was built with.
+    //! A chain opened read-only keeps every segment as it is
+    std::string text( Channel::kBufferSize, '\0' );
+    const auto size{ is_open() ? ::pread64( native_handle(), & text[ 0 ], text.size(), 0 ) : 0 };
+    std::size_t segments{ 1 };
+    std::size_t keySize{ kKeySize };
+    std::size_t valueSize{ kValueSize };
+    std::size_t blockSize{ 0 };
+    int format{ 0 };
+    bool sized{ false };
+    std::string name{};
+
+    text.resize( static_cast<std::size_t>( std::max<ssize_t>( size, 0 ) ) );
+    std::istringstream input{ text };
+
+    while ( input >> name )
+    {
+        if ( name == "blocks" )
+        {
+            input >> m_segmentBlocks;
+            sized = true;
+        }
+        else if ( name == "segments" )
+        {
+            input >> segments;
+        }
+        else if ( name == "key" )
+        {
+            input >> keySize;
+        }
+        else if ( name == "value" )
+        {
+            input >> valueSize;
+        }
+        else if ( name == "block" )
+        {
+            input >> blockSize;
+        }
+        else if ( name == "format" )
+        {
+            input >> format;
+        }
+    }
+
+    if ( format > kFormat )
+    {
+        throw std::runtime_error( "The blockchain format " + std::to_string( format ) +
+                                  " is newer than the supported " + std::to_string( kFormat ) );
+    }
+
+    if ( keySize == kKeySize && valueSize == kValueSize && blockSize == getBlockSize() - kFormerBlockSize )
+    {
+        throw std::runtime_error( "The blockchain has the format 1 blocks of " + std::to_string( blockSize ) +
+                                  " bytes which weren't mined, remove it to sync the chain anew" );
+    }
+
+    if ( keySize != kKeySize || valueSize != kValueSize || ( blockSize != 0 && blockSize != getBlockSize() ) )
+    {
+        throw std::runtime_error( "The blockchain layout " + std::to_string( keySize ) + '/' +
+                                  std::to_string( valueSize ) + '/' + std::to_string( blockSize ) +
+                                  " doesn't match the built one " + std::to_string( kKeySize ) + '/' +
+                                  std::to_string( kValueSize ) + '/' + std::to_string( getBlockSize() ) );
+    }
+
+    if ( m_segmentBlocks == 0 || segments == 0 )
+    {
+        throw std::runtime_error( "The blockchain manifest is invalid" );
+    }
+
+    //! The blocks of a chain which doesn't record their size may be laid out otherwise,
+    //! the recovery of the tail would cut them
+    if ( blockSize == 0 )
+    {
+        checkLayout( segments );
+    }
+
+    //! A chain kept in a single file before the segments may be longer than one of them,
+    //! its segments are made long enough to hold that file as the first one
+    struct stat status{};
+
+    if ( ! sized && m_storage != Storage::kMemory && ::stat( getSegmentPath( 0 ).c_str(), & status ) == 0 &&
+         static_cast<std::uint64_t>( status.st_size ) / getBlockSize() > m_segmentBlocks )
+    {
+        m_segmentBlocks = ( static_cast<std::uint64_t>( status.st_size ) / getBlockSize() / kSegmentBlocks + 1 ) * kSegmentBlocks;
+        BOOST_LOG_TRIVIAL( info ) << "The blockchain segments hold " << m_segmentBlocks << " blocks to fit the former single file";
+    }
+
+    for ( auto number{ 0ull }; number < segments; ++number )
+    {
+        const auto sealed{ number + 1 < segments };
+        m_segments.push_back( std::make_shared<Segment>( getSegmentPath( number ),
+                                                         number * m_segmentBlocks,
+                                                         m_storage ) );
+
+        if ( m_segments.back()->open( sealed || m_readOnly ) != m_segmentBlocks && sealed )
+        {
+            throw std::runtime_error( "The blockchain segment " + getSegmentPath( number ) + " is incomplete" );
+        }
+    }
+
+    m_count = m_segments.back()->getFirst() + m_segments.back()->getCount();
+    publishLayout();
+
+    if ( ! m_readOnly )
+    {
+        writeManifest();
+    }
+}
+
+void Blockchain::checkLayout( const std::size_t segments ) const
+{
+    //! The writable segment is never archived, it holds whole blocks and its second block
+    //! follows the first one right after it when the layouts are the same. A torn block
+    //! can't be told from another layout, such a chain isn't recovered either
+    const auto path{ getSegmentPath( segments - 1 ) };
+    const auto descriptor{ m_storage == Storage::kMemory ? -1 : ::open( path.c_str(), O_RDONLY ) };
+    std::uint64_t index{ ( segments - 1 ) * m_segmentBlocks + 1 };
+
+    if ( descriptor < 0 )
+    {
+        return;
+    }
+
+    const auto second{ ( segments - 1 ) * m_segmentBlocks + 1 };
+    const auto formerSize{ getBlockSize() - kFormerBlockSize };
+    auto formerIndex{ index };
+    const auto size{ ::lseek64( descriptor, 0, SEEK_END ) };
+    const auto readed{ ::pread64( descriptor, & index, sizeof( index ), static_cast<std::int64_t>( getBlockSize() ) ) };
+    const auto formerReaded{ ::pread64( descriptor, & formerIndex, sizeof( formerIndex ), static_cast<std::int64_t>( formerSize ) ) };
+
+    ::close( descriptor );
+
+    if ( size < 0 || static_cast<std::uint64_t>( size ) % getBlockSize() != 0 ||
+         ( readed > 0 && ( readed != sizeof( index ) || index != second ) ) )
+    {
+        if ( size > 0 && static_cast<std::uint64_t>( size ) % formerSize == 0 &&
+             formerReaded == sizeof( formerIndex ) && formerIndex == second )
+        {
+            throw std::runtime_error( "The blockchain " + path + " has the format 1 blocks of " +
+                                      std::to_string( formerSize ) + " bytes which weren't mined, "
+                                      "remove it to sync the chain anew" );
+        }
+
+        throw std::runtime_error( "The blockchain " + path + " doesn't have blocks of " +
+                                  std::to_string( getBlockSize() ) + " bytes" );
+    }
+}
+
+void Blockchain::rollSegment()
+{
+    //! Expects m_mutex to be locked by the caller
+    const auto number{ m_segments.size() };
+
+    m_segments.back()->seal();
+    m_segments.push_back( std::make_shared<Segment>( getSegmentPath( number ),
+                                                     number * m_segmentBlocks,
+                                                     m_storage ) );
+    m_segments.back()->open( false );
+    writeManifest();
+
+    if ( m_archive )
+    {
+        std::lock_guard<std::mutex> lock{ m_archiveMutex };
+
+        m_unarchived.push_back( number - 1 );
+        m_archiveCondition.notify_one();
+    }
+}
+
+void Blockchain::writeManifest()
+{
+    std::ostringstream output{};
+
+    output << "blocks " << m_segmentBlocks << kEndLine
+           << "segments " << m_segments.size() << kEndLine
+           << "key " << kKeySize << kEndLine
+           << "value " << kValueSize << kEndLine
+           << "block " << getBlockSize() << kEndLine
+           << "format " << kFormat << kEndLine;
+
+    const auto text{ output.str() };
+
+    if ( ::pwrite64( native_handle(), text.data(), text.size(), 0 ) != static_cast<ssize_t>( text.size() ) ||
+         ::ftruncate64( native_handle(), static_cast<std::int64_t>( text.size() ) ) != 0 ||
+         ::fdatasync( native_handle() ) != 0 )
+    {
+        throwLastError( "Failed to write the blockchain manifest" );
+    }
+}
+
+std::string Blockchain::getSegmentPath( const std::size_t number ) const
+{
+    //! The first segment keeps the name of the former single file chain
+    return number == 0 ? m_path : m_path + '.' + std::to_string( number );
+}
+
+std::uint64_t Blockchain::findValueTail( const std::uint64_t begin,
+                                         const std::uint64_t end,
+                                         const std::uint64_t valueTail )
+{
+    //! The heap holds the values of the chain in its order and ends with the value
+    //! of the last block referring to it, which is usually near the tail. The given
+    //! tail is where the heap ends as of the blocks before begin
+    std::vector<Block> blocks( kVerifyBatch );
+
+    for ( auto last{ end }; last > begin; )
+    {
+        const auto first{ last - std::min<std::uint64_t>( last - begin, blocks.size() ) };
+        const auto loaded{ loadBlocks( first, last - first, blocks.data() ) };
+
+        for ( auto i{ loaded }; i > 0; --i )
+        {
+            ValueHeap::Reference reference{};
+
+            if ( ValueHeap::getReference( blocks[ i - 1 ].value, reference ) )
+            {
+                return reference.offset + reference.length;
+            }
+        }
+
+        last = first;
+    }
+
+    return valueTail;
+}
+
+void Blockchain::recoverTail()
+{
+    //! Only the writable segment can hold blocks torn by a crash, and only its last
+    //! blocks are checked against their stored hashes, so recovery takes constant time.
+    //! Blocks without a stored hash come from chains written before the hash column
+    //! existed, those are only rejected when they were never written at all.
+    const auto & tail{ * m_segments.back() };
+    const auto first{ std::max( tail.getFirst(), m_count > kRecoveryBlocks ? m_count - kRecoveryBlocks : 0 ) };
+    auto valid{ m_count };
+
+    for ( auto index{ first }; index < m_count && valid == m_count; ++index )
+    {
+        const auto block{ loadBlock( index ) };
+        const auto begin{ block.getRawPointer() };
+        Block::Sha256 hash{};
+
+        if ( m_hashColumn->get( index, hash ) ?
+             hash != block.calculateHash() :
+             std::all_of( begin, begin + getBlockSize(), []( const auto byte ) { return byte == 0; } ) )
+        {
+            valid = index;
+        }
+    }
+
+    if ( valid < m_count )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Truncated " << m_count - valid << " torn blocks at the end of the blockchain";
+        m_segments.back()->truncate( valid - tail.getFirst() );
+        m_count = valid;
+        publishLayout();
+    }
+}
+
+void Blockchain::checkpoint()
+{
+    //! Verifies the blocks appended since the last checkpoint and moves it forward
+    std::unique_lock<std::mutex> lock{ m_checkpointMutex, std::try_to_lock };
+
+    if ( lock.owns_lock() && is_open() && ! m_readOnly && revalidate() == 0 )
+    {
+        saveCheckpoint();
+    }
+}
+
+void Blockchain::loadCheckpoint()
+{
+    const auto path{ getSidecarPath( ".checkpoint" ) };
+    const auto descriptor{ path.empty() ? -1 : ::open( path.c_str(), O_RDONLY ) };
+    Checkpoint checkpoint{};
+
+    m_verifiedCount = 0;
+    m_checkpointCount = 0;
+    m_checkpointValueTail = 0;
+
+    if ( descriptor >= 0 )
+    {
+        const auto readed{ ::read( descriptor, & checkpoint, sizeof( checkpoint ) ) };
+
+        ::close( descriptor );
+
+        //! The checkpoint is only trusted when its block is still in the chain unchanged.
+        //! One saved before it kept the value tail still saves the verification
+        if ( ( readed == sizeof( checkpoint ) || readed == sizeof( checkpoint ) - sizeof( checkpoint.valueTail ) ) &&
+             checkpoint.index < m_count &&
+             checkpoint.length <= m_count * getBlockSize() &&
+             loadBlock( checkpoint.index ).calculateHash() == checkpoint.hash )
+        {
+            m_verifiedCount = checkpoint.index + 1;
+
+            if ( readed == sizeof( checkpoint ) )
+            {
+                m_checkpointCount = m_verifiedCount;
+                m_checkpointValueTail = checkpoint.valueTail;
+            }
+        }
+        else
+        {
+            BOOST_LOG_TRIVIAL( warning ) << "Ignored the blockchain checkpoint which doesn't match the chain";
+        }
+    }
+
+    m_checkedCount = m_verifiedCount;
+    BOOST_LOG_TRIVIAL( info ) << "The blockchain is verified up to block " << m_verifiedCount;
+}
+
+void Blockchain::saveCheckpoint()
+{
+    const auto path{ getSidecarPath( ".checkpoint" ) };
+    const auto temporary{ path + ".tmp" };
+
+    //! A chain kept in memory starts over on every open, there is nothing to resume
+    if ( path.empty() )
+    {
+        return;
+    }
+
+    const auto descriptor{ ::open( temporary.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0640 ) };
+    Checkpoint checkpoint{};
+
+    checkpoint.index = m_verifiedCount - 1;
+    checkpoint.length = m_verifiedCount * getBlockSize();
+    checkpoint.hash = loadBlock( checkpoint.index ).calculateHash();
+    checkpoint.valueTail = findValueTail( m_checkpointCount, m_verifiedCount, m_checkpointValueTail );
+
+    const auto written{ descriptor >= 0 ? ::write( descriptor, & checkpoint, sizeof( checkpoint ) ) : -1 };
+    const auto synced{ descriptor >= 0 && ::fdatasync( descriptor ) == 0 };
+
+    ::close( descriptor );
+
+    if ( written != sizeof( checkpoint ) || ! synced || ::rename( temporary.c_str(), path.c_str() ) != 0 )
+    {
+        BOOST_LOG_TRIVIAL( error ) << "Failed to save the blockchain checkpoint";
+        return;
+    }
+
+    m_checkpointCount = m_verifiedCount;
+    m_checkpointValueTail = checkpoint.valueTail;
+}
+
+void Blockchain::updateAccumulator()
+{
+    const auto count{ m_count };
+    auto accumulated{ m_accumulator->getCount() };
+
+    if ( accumulated > count )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "The accumulator is ahead of the blockchain, truncating";
+        m_accumulator->truncate( count );
+        accumulated = count;
+    }
+
+    if ( accumulated < count )
+    {
+        BOOST_LOG_TRIVIAL( info ) << "Accumulating " << count - accumulated << " block hashes";
+    }
+
+    for ( ; accumulated < count; ++accumulated )
+    {
+        Block::Sha256 hash{};
+
+        if ( ! m_hashColumn->get( accumulated, hash ) )
+        {
+            hash = loadBlock( accumulated ).calculateHash();
+        }
+
+        m_accumulator->append( hash );
+
+        if ( accumulated % kVerifyBatch == 0 )
+        {
+            m_accumulator->flush();
+        }
+    }
+
+    m_accumulator->flush();
+}
+
+void Blockchain::updateHashColumn()
+{
+    const auto count{ m_count };
+    auto hashed{ m_hashColumn->getCount() };
+    std::vector<Block> blocks( kVerifyBatch );
+    std::vector<Block::Sha256> hashes( kVerifyBatch );
+
+    if ( hashed > count )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "The hash column is ahead of the blockchain, truncating";
+        m_hashColumn->truncate( count );
+        hashed = count;
+    }
+
+    if ( hashed < count )
+    {
+        BOOST_LOG_TRIVIAL( info ) << "Hashing " << count - hashed << " blocks";
+    }
+
+    while ( hashed < count )
+    {
+        const auto size{ std::min<std::uint64_t>( kVerifyBatch, count - hashed ) };
+
+        std::fill( blocks.begin() + static_cast<std::ptrdiff_t>( loadBlocks( hashed, size, blocks.data() ) ),
+                   blocks.end(), Block{} );
+        Block::hashBlocks( blocks.data(), size, hashes.data() );
+
+        for ( auto i{ 0ull }; i < size; ++i )
+        {
+            m_hashColumn->append( hashes[ i ] );
+        }
+
+        m_hashColumn->flush();
+        hashed += size;
+    }
+}
+
+void Blockchain::updateKeyIndex()
+{
+    const auto count{ m_count };
+    auto indexed{ m_keyIndex->open( count ) };
+
+    if ( indexed < count )
+    {
+        BOOST_LOG_TRIVIAL( info ) << "Indexing keys of " << count - indexed << " blocks";
+    }
+
+    //! The blocks are read ahead in chunks rather than one by one
+    const auto last{ begin( count ) };
+
+    for ( auto it{ begin( indexed ) }; it != last; ++it )
+    {
+        Block block{};
+
+        std::copy_n( * it, getBlockSize(), block.getRawPointer() );
+        m_keyIndex->append( block );
+    }
+
+    m_keyIndex->flush();
+}
+
+int Blockchain::openFile( const std::string & path,
+                          const int flags )
+{
+    if ( ! path.empty() )
+    {
+        return ::open( path.c_str(), flags, 0640 );
+    }
+
+    const auto descriptor{ ::memfd_create( "bitchat", MFD_CLOEXEC ) };
+
+    if ( descriptor >= 0 && ( flags & O_APPEND ) != 0 && ::fcntl( descriptor, F_SETFL, O_APPEND ) != 0 )
+    {
+        ::close( descriptor );
+        return -1;
+    }
+
+    return descriptor;
+}
+
+std::string Blockchain::getSidecarPath( const char * suffix ) const
+{
+    //! A chain kept in memory keeps everything beside it in memory too
+    return m_storage == Storage::kMemory ? std::string{} : m_path + suffix;
+}
+
+void Blockchain::throwLastError( const char * what )
+{
+    const boost::system::error_code error{ errno, boost::system::system_category() };
+    throw boost::system::system_error{ error, what };
+}
+
+std::string Blockchain::convertBlock( const Block & block )
+{
+    return std::string{ block.getRawPointer(), getBlockSize() };
+}
+
+Blockchain::Block Blockchain::convertBlock( const std::string & data )
+{
+    Block result{};
+
+    if ( data.size() != getBlockSize() )
+    {
+        throw std::runtime_error( "Invalid block size - " + std::to_string( data.size() ) );
+    }
+
+    std::copy( data.begin(), data.end(), result.getRawPointer() );
+
+    return result;
+}
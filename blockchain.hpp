@@ -1,6 +1,24 @@
 #pragma once
 
 #include "filechannel.hpp"
+#include <boost/asio/deadline_timer.hpp>
+#include <vector>
+#include <deque>
+#include <map>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+//! The block layout is fixed at build time, every node of a network must use the same one
+#ifndef BITCHAT_KEY_SIZE
+#define BITCHAT_KEY_SIZE 20
+#endif
+
+#ifndef BITCHAT_VALUE_SIZE
+#define BITCHAT_VALUE_SIZE 140
+#endif
 
 namespace bitchat {
 
@@ -8,22 +26,79 @@ class Communication;
 
 class Blockchain : protected FileChannel
 {
-    class Block;
+    template <std::size_t KeySize, std::size_t ValueSize>
+    struct BasicBlock;
+    class KeyIndex;
+    class TimeIndex;
+    class HashColumn;
+    class Segment;
+    class Store;
+    class FileStore;
+    class MappedStore;
+    class MemoryStore;
+    class Archive;
+    class Miner;
+    class Accumulator;
+    class Ring;
+    class ValueHeap;
+    struct Head;
+    struct Header;
+    struct Checkpoint;
 
 public:
+    class Iterator;
     class Event : public BaseEvent{};
 
-    static constexpr auto kKeySize{ 20 };
-    static constexpr auto kValueSize{ 140 };
+    enum class Storage
+    {
+        kStream,    //! seek and read the file for every block
+        kMapped,    //! read blocks straight from the memory mapped file
+        kRing,      //! submit appends and range reads to io_uring
+        kMemory     //! keep the blocks in memory only, the chain starts empty on every open
+    };
+
+    enum class Sync
+    {
+        kNone,      //! leave flushing to the operating system
+        kBatch,     //! fdatasync every committed batch
+        kPeriodic   //! fdatasync at most once per sync interval
+    };
+
+    static constexpr std::size_t kKeySize{ BITCHAT_KEY_SIZE };
+    static constexpr std::size_t kValueSize{ BITCHAT_VALUE_SIZE };
+    static constexpr std::size_t kMaximumValueSize{ 64 * 1024 };   //! 64KB, longer values go to the value heap
     static constexpr auto kRequestBlock{ 'r' };
     static constexpr auto kResponseBlock{ 'b' };
     static constexpr auto kNewBlock{ 'n' };
+    static constexpr auto kRequestRoot{ 'q' };
+    static constexpr auto kResponseRoot{ 'm' };
+    static constexpr auto kNewValue{ 'v' };
+    static constexpr auto kRequestBlocks{ 's' };
+    static constexpr auto kResponseBlocks{ 'c' };
+    static constexpr std::uint64_t kRangeBlocks{ 1024 };    //! the most blocks sent in one range response
+    static constexpr auto kInventory{ 'i' };
+    static constexpr auto kRequestHeaders{ 'h' };
+    static constexpr auto kResponseHeaders{ 'e' };
+    static constexpr std::uint64_t kRangeHeaders{ 8192 };   //! the most headers sent in one response
     static const Event kOnSave;
 
+private:
+    using Block = BasicBlock<kKeySize, kValueSize>;
+
+public:
     explicit Blockchain( const CommunicationPtr & communication,
-                         const std::string & path );
+                         const std::string & path,
+                         const Storage storage,
+                         const Sync sync,
+                         const bool archive,
+                         const std::uint8_t difficult );
+    ~Blockchain() override;
 
     void open() override;
+    //! Opens the blocks of an existing chain and changes nothing on the disk, neither
+    //! the manifest, the sidecars nor a torn tail. Only verify and the reads of blocks
+    //! work on a chain opened so
+    void openReadOnly();
     void  close() override;
 
     std::size_t getHeadIndex();
@@ -32,33 +107,243 @@ public:
     std::string getHeadValue();
     std::int64_t getHeadTimestamp();
 
+    std::string getKey( const std::uint64_t index );
+    std::string getValue( const std::uint64_t index );
+    std::int64_t getTimestamp( const std::uint64_t index );
+
+    std::string getHash( const std::uint64_t index );
+    //! Whether the chain holds the block with the raw hash at the index, committed or not
+    bool hasBlock( const std::uint64_t index,
+                   const std::string & hash );
+
+    //! The bounds of the search for the first block which differs from a peer's chain,
+    //! the roots over the first same blocks are equal and over the first different are not
+    struct Fork
+    {
+        std::uint64_t same;
+        std::uint64_t different;
+    };
+
+    //! The Merkle root over the first count blocks
+    std::string getRoot( const std::uint64_t count );
+    std::string getProof( const std::uint64_t index,
+                          const std::uint64_t count );
+    static bool verifyProof( const std::string & rawBlock,
+                             const std::uint64_t count,
+                             const std::string & proof,
+                             const std::string & root );
+
+    //! Narrows the fork down with the peer root over count blocks, returns the count
+    //! to ask the peer root over next or 0 once the first differing block is fork.same
+    std::uint64_t findFork( Fork & fork,
+                            const std::uint64_t count,
+                            const std::string & root );
+
+    std::vector<std::uint64_t> findByKey( const std::string & key );
+    std::vector<std::uint64_t> findRange( const std::int64_t fromMs,
+                                          const std::int64_t toMs );
+
+    std::uint64_t verify( const std::uint64_t from );
+    std::uint64_t revalidate();
+
 //    std::string loadBlockDataByIndex( const std::uint64_t index );
 
     void save( const std::string & rawBlock );
+    //! Keeps a value sent ahead of the block which refers to it
+    void saveValue( const std::string & value );
+    //! Records the hashes the blocks fetched next must have, returns how many
+    //! of the headers continue the chain from its tail
+    std::uint64_t saveHeaders( const std::string & headers );
     void store( const std::string & key,
                 const std::string & value );
 
+    std::uint64_t getHashRate() const;
+
     std::string makeBlockRequest( const std::uint64_t index );
     std::string makeBlockResponse( const std::uint64_t index );
-    std::string makeNewBlock( const std::uint64_t index );
+
+    using BlocksHandler = std::function<void ( const std::string & blocks )>;
+
+    //! The raw bytes of blocks, they are shared with the head or the store where
+    //! possible and copied only otherwise
+    using View = std::shared_ptr<const char>;
+    //! Gets a message and the size bytes of the view which follow its payload
+    using ResponseHandler = std::function<void ( std::string message,
+                                                 const View & data,
+                                                 const std::size_t size )>;
+
+    //! Up to count blocks from the index which lie in one piece of the store, the count
+    //! shrinks to how many of them the view holds. Empty when the store doesn't keep them
+    View viewBlocks( const std::uint64_t index,
+                     std::uint64_t & count );
+
+    //! The block goes out of the head or the store as it is, without a copy
+    void makeBlockResponse( const std::uint64_t index,
+                            const ResponseHandler & handler );
+
+    //! The response carries the first index and the count of the blocks which follow it,
+    //! up to kRangeBlocks of them and fewer when their values in the heap take more than
+    //! the asker keeps. The handler gets every message on its own, the values come first
+    std::string makeBlocksRequest( const std::uint64_t index,
+                                   const std::uint64_t count );
+    void makeBlocksResponse( const std::uint64_t index,
+                             const std::uint64_t count,
+                             const ResponseHandler & handler );
+    void readBlocks( const std::uint64_t index,
+                     const std::uint64_t count,
+                     const BlocksHandler & handler );
+
+    //! Fills the buffer with up to count raw blocks, returns how many were loaded
+    std::uint64_t loadBlocks( const std::uint64_t begin,
+                              const std::uint64_t count,
+                              char * buffer );
+
+    Iterator begin( const std::uint64_t from = 0 );
+    Iterator end();
+    //! The value of a block kept in the value heap, empty when the block inlines it
+    std::string makeNewValue( const std::uint64_t index );
+    std::string makeRootRequest( const std::uint64_t count );
+    std::string makeRootResponse( const std::uint64_t count );
+    //! Announces a block by its index and raw hash, the peers fetch it only when they miss it
+    std::string makeInventory( const std::uint64_t index );
+    //! The response carries the first index and the count of the headers which follow it
+    std::string makeHeadersRequest( const std::uint64_t index,
+                                    const std::uint64_t count );
+    std::string makeHeadersResponse( const std::uint64_t index,
+                                     const std::uint64_t count );
 
     static std::uint64_t extractBlockIndex( const std::string & data );
     static std::size_t getBlockSize();
+    static std::size_t getRootSize();
+    static std::size_t getMaximumValueSize();
+    static std::size_t getInventorySize();
+    static std::size_t getHeaderSize();
 
 private:
+    using HeadPtr = std::shared_ptr<const Head>;
+    using Batch = std::vector<HeadPtr>;
+    using SegmentPtr = std::shared_ptr<Segment>;
+
+    //! The segments and the count of the committed blocks as the reads see them,
+    //! replaced whole on every change so they read without the commit mutex
+    struct Layout
+    {
+        std::vector<SegmentPtr> segments;
+        std::uint64_t count;
+    };
+    using LayoutPtr = std::shared_ptr<const Layout>;
+
     Block getBlock( const std::uint64_t index );
+    //! The raw hash of a block
+    std::string loadHash( const std::uint64_t index );
+    std::string loadValue( const Block & block );
+    std::string makeNewValue( const Block & block );
+    HeadPtr getHead() const;
+    void setHead( const HeadPtr & head );
+    LayoutPtr getLayout() const;
+    void publishLayout();
 
+    Block makeBlock( const std::string & key,
+                     const std::string & value ) const;
+    void mine();
+    void stopMining();
+    void archive();
+    void stopArchiving();
+    void append( const HeadPtr & head );
+    void commit();
+    void completeBlocks( const Batch & batch );
+    void finishCommit( const Batch & batch,
+                       std::unique_lock<std::mutex> & lock );
+    void sync();
+    void scheduleSync();
+
+    std::uint64_t getBlocksCount();
+    std::uint64_t verifyLinks( const std::uint64_t begin,
+                               const std::uint64_t end );
     Block loadBlock( const std::uint64_t index );
+    std::uint64_t loadBlocks( const std::uint64_t begin,
+                              const std::uint64_t count,
+                              Block * blocks );
     void saveBlock( const Block & block );
+    bool saveBlocks( const Batch & batch );
+    bool writeBlocks( const Batch & batch );
+    void indexBlocks( const Batch & batch );
+
+    void makeBlocksResponse( const std::uint64_t index,
+                             const View & blocks,
+                             const std::uint64_t count,
+                             const ResponseHandler & handler );
+
+    void openSegments();
+    void checkLayout( const std::size_t segments ) const;
+    void rollSegment();
+    void writeManifest();
+    std::string getSegmentPath( const std::size_t number ) const;
+    void recoverTail();
+    void checkpoint();
+    void loadCheckpoint();
+    void saveCheckpoint();
+    void updateKeyIndex();
+    void updateHashColumn();
+    void updateAccumulator();
+    std::uint64_t findValueTail( const std::uint64_t begin,
+                                 const std::uint64_t end,
+                                 const std::uint64_t valueTail );
 
+    static void throwLastError( const char * what );
+    //! Opens a file kept beside the chain, an empty path gives an anonymous one in memory
+    static int openFile( const std::string & path,
+                         const int flags );
+    std::string getSidecarPath( const char * suffix ) const;
     static std::string convertBlock( const Block & block );
     static Block convertBlock( const std::string & block );
-//    void proofOfWork( Block & block );
 
 private:
     const std::string m_path;
-    std::size_t m_headIndex;
-//    std::shared_ptr<Block> m_headBlock;
+    const Storage m_storage;
+    const Sync m_sync;
+    const bool m_archive;
+    const std::uint8_t m_difficult;
+    bool m_readOnly;
+    std::atomic<std::size_t> m_headIndex;
+    std::uint64_t m_count;
+    std::uint64_t m_segmentBlocks;
+    std::vector<SegmentPtr> m_segments;
+    std::mutex m_mutex;
+    LayoutPtr m_layout;
+    HeadPtr m_head;
+    std::unique_ptr<KeyIndex> m_keyIndex;
+    std::unique_ptr<TimeIndex> m_timeIndex;
+    std::unique_ptr<HashColumn> m_hashColumn;
+    std::unique_ptr<Accumulator> m_accumulator;
+    std::unique_ptr<ValueHeap> m_valueHeap;
+    std::atomic<std::uint64_t> m_verifiedCount;
+    std::uint64_t m_checkedCount;
+    std::uint64_t m_checkpointCount;    //! the blocks the saved checkpoint covers
+    std::uint64_t m_checkpointValueTail;    //! the end of the value heap as of them
+    std::mutex m_checkpointMutex;
+    std::mutex m_queueMutex;
+    HeadPtr m_tail;
+    std::uint64_t m_valueTail;  //! the end of the value heap as of m_tail
+    std::deque<std::pair<std::string, std::string>> m_receivedValues;  //! hashes and values as they arrived
+    std::size_t m_receivedSize;
+    std::map<std::uint64_t, std::string> m_expectedHashes;  //! by the indexes of the announced headers
+    Batch m_pending;
+    bool m_commitScheduled;
+    bool m_syncScheduled;
+    boost::asio::deadline_timer m_syncTimer;
+    std::unique_ptr<Miner> m_miner;
+    std::deque<std::pair<std::string, std::string>> m_unmined;
+    bool m_miningStopped;
+    std::condition_variable m_miningCondition;  //! signals m_unmined and m_miningStopped
+    std::thread m_miningThread;
+    std::deque<std::size_t> m_unarchived;   //! the numbers of the sealed segments kept raw
+    bool m_archivingStopped;
+    std::mutex m_archiveMutex;
+    std::condition_variable m_archiveCondition;
+    std::thread m_archiveThread;
+    std::unique_ptr<Ring> m_ring;
+    bool m_writing;
 };
 
 
@@ -0,0 +1,336 @@
+#include "blockchain_accumulator.hpp"
+#include "hasher.hpp"
+#include <boost/log/trivial.hpp>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+using bitchat::Blockchain;
+
+namespace
+{
+//! A perfect tree of the range, the leaves are split into mountains by the bits of their count
+struct Mountain
+{
+    std::uint64_t first;    //! the first leaf
+    std::uint64_t height;
+    std::uint64_t peak;     //! the position of the peak node
+};
+
+std::vector<Mountain> getMountains( const std::uint64_t count )
+{
+    std::vector<Mountain> result{};
+    std::uint64_t first{ 0 };
+    std::uint64_t size{ 0 };
+
+    for ( auto height{ 64u }; height > 0; --height )
+    {
+        const auto leaves{ 1ull << ( height - 1 ) };
+
+        if ( ( count & leaves ) != 0 )
+        {
+            size += 2 * leaves - 1;
+            result.push_back( Mountain{ first, height - 1, size - 1 } );
+            first += leaves;
+        }
+    }
+
+    return result;
+}
+}
+
+Blockchain::Accumulator::Accumulator( const std::string & path ) :
+    m_path{ path },
+    m_descriptor{ -1 },
+    m_count{ 0 },
+    m_size{ 0 }
+{
+}
+
+Blockchain::Accumulator::~Accumulator()
+{
+    close();
+}
+
+std::uint64_t Blockchain::Accumulator::open()
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    m_descriptor = openFile( m_path, O_CREAT | O_RDWR | O_APPEND );
+
+    if ( m_descriptor < 0 )
+    {
+        throwLastError( "Failed to open the accumulator" );
+    }
+
+    const auto length{ static_cast<std::uint64_t>( ::lseek64( m_descriptor, 0, SEEK_END ) ) };
+    const auto nodes{ length / kHashSize };
+
+    //! A crash may leave a leaf without the parents it completes, those are dropped with it
+    m_count = nodes / 2 + 64;
+
+    while ( getSize( m_count ) > nodes )
+    {
+        --m_count;
+    }
+
+    m_size = getSize( m_count );
+
+    if ( m_size * kHashSize != length )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Dropped a torn accumulator append at " << m_count;
+        ::ftruncate64( m_descriptor, static_cast<std::int64_t>( m_size * kHashSize ) );
+    }
+
+    loadPeaks();
+
+    return m_count;
+}
+
+void Blockchain::Accumulator::close()
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    if ( m_descriptor >= 0 )
+    {
+        ::close( m_descriptor );
+        m_descriptor = -1;
+    }
+
+    m_count = 0;
+    m_size = 0;
+    m_peaks.clear();
+    m_pending.clear();
+}
+
+void Blockchain::Accumulator::truncate( const std::uint64_t count )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    if ( ::ftruncate64( m_descriptor, static_cast<std::int64_t>( getSize( count ) * kHashSize ) ) != 0 )
+    {
+        throwLastError( "Failed to truncate the accumulator" );
+    }
+
+    m_count = count;
+    m_size = getSize( count );
+    m_pending.clear();
+    loadPeaks();
+}
+
+std::uint64_t Blockchain::Accumulator::getCount() const
+{
+    return m_count;
+}
+
+void Blockchain::Accumulator::append( const Block::Sha256 & hash )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+    auto node{ hash };
+
+    m_pending.append( node.begin(), node.end() );
+
+    //! Every trailing one bit of the count is a mountain of the same height to merge with
+    for ( auto count{ m_count }; ( count & 1 ) != 0; count >>= 1 )
+    {
+        node = merge( m_peaks.back(), node );
+        m_peaks.pop_back();
+        m_pending.append( node.begin(), node.end() );
+    }
+
+    m_peaks.push_back( node );
+    ++m_count;
+    m_size = getSize( m_count );
+}
+
+void Blockchain::Accumulator::flush()
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    if ( ! m_pending.empty() )
+    {
+        if ( ::write( m_descriptor, m_pending.data(), m_pending.size() ) !=
+             static_cast<ssize_t>( m_pending.size() ) )
+        {
+            throwLastError( "Failed to write the accumulator" );
+        }
+
+        m_pending.clear();
+    }
+}
+
+Blockchain::Block::Sha256 Blockchain::Accumulator::getRoot( const std::uint64_t count )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+    const auto mountains{ getMountains( count ) };
+    Block::Sha256 result{};
+
+    BOOST_ASSERT( count <= m_count );
+
+    for ( auto i{ mountains.size() }; i > 0; --i )
+    {
+        const auto peak{ count == m_count ? m_peaks[ i - 1 ] : read( mountains[ i - 1 ].peak ) };
+
+        result = i == mountains.size() ? peak : merge( peak, result );
+    }
+
+    return result;
+}
+
+Blockchain::Accumulator::Proof Blockchain::Accumulator::prove( const std::uint64_t index,
+                                                               const std::uint64_t count )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+    const auto mountains{ getMountains( count ) };
+    Proof result{};
+    Proof peaks{};
+
+    BOOST_ASSERT( index < count && count <= m_count );
+
+    for ( const auto & mountain : mountains )
+    {
+        if ( index >= mountain.first + ( 1ull << mountain.height ) )
+        {
+            peaks.push_back( read( mountain.peak ) );
+        }
+        else if ( index >= mountain.first )
+        {
+            auto position{ mountain.peak };
+
+            //! Descends from the peak, the left child of a node at height h is 2^h positions back
+            for ( auto height{ mountain.height }; height > 0; --height )
+            {
+                const auto left{ position - ( 1ull << height ) };
+                const auto right{ position - 1 };
+                const auto isRight{ ( ( index - mountain.first ) >> ( height - 1 ) & 1 ) != 0 };
+
+                result.push_back( read( isRight ? left : right ) );
+                position = isRight ? right : left;
+            }
+
+            std::reverse( result.begin(), result.end() );
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    result.insert( result.end(), peaks.begin(), peaks.end() );
+
+    if ( mountains.back().first > index )
+    {
+        Block::Sha256 bag{};
+
+        for ( auto i{ mountains.size() }; i > 0 && mountains[ i - 1 ].first > index; --i )
+        {
+            const auto peak{ read( mountains[ i - 1 ].peak ) };
+
+            bag = i == mountains.size() ? peak : merge( peak, bag );
+        }
+
+        result.push_back( bag );
+    }
+
+    return result;
+}
+
+bool Blockchain::Accumulator::verify( const Block::Sha256 & hash,
+                                      const std::uint64_t index,
+                                      const std::uint64_t count,
+                                      const Proof & proof,
+                                      const Block::Sha256 & root )
+{
+    if ( index >= count )
+    {
+        return false;
+    }
+
+    const auto mountains{ getMountains( count ) };
+    auto own{ mountains.size() };
+
+    while ( mountains[ own - 1 ].first > index )
+    {
+        --own;
+    }
+
+    const auto & mountain{ mountains[ own - 1 ] };
+    const auto left{ own - 1 };
+    const auto right{ own < mountains.size() ? 1u : 0u };
+
+    if ( proof.size() != mountain.height + left + right )
+    {
+        return false;
+    }
+
+    auto node{ hash };
+
+    for ( auto height{ 0ull }; height < mountain.height; ++height )
+    {
+        const auto isRight{ ( ( index - mountain.first ) >> height & 1 ) != 0 };
+
+        node = isRight ? merge( proof[ height ], node ) : merge( node, proof[ height ] );
+    }
+
+    if ( right != 0 )
+    {
+        node = merge( node, proof.back() );
+    }
+
+    for ( auto i{ left }; i > 0; --i )
+    {
+        node = merge( proof[ mountain.height + i - 1 ], node );
+    }
+
+    return node == root;
+}
+
+Blockchain::Block::Sha256 Blockchain::Accumulator::read( const std::uint64_t position )
+{
+    //! Expects m_mutex to be locked by the caller
+    const auto flushed{ m_size - m_pending.size() / kHashSize };
+    Block::Sha256 result{};
+
+    if ( position >= flushed )
+    {
+        const auto begin{ m_pending.begin() + static_cast<std::ptrdiff_t>( ( position - flushed ) * kHashSize ) };
+
+        std::copy( begin, begin + kHashSize, result.begin() );
+    }
+    else if ( ::pread64( m_descriptor, result.data(), kHashSize, static_cast<std::int64_t>( position * kHashSize ) ) !=
+              static_cast<ssize_t>( kHashSize ) )
+    {
+        throwLastError( "Failed to read the accumulator" );
+    }
+
+    return result;
+}
+
+void Blockchain::Accumulator::loadPeaks()
+{
+    //! Expects m_mutex to be locked by the caller
+    m_peaks.clear();
+
+    for ( const auto & mountain : getMountains( m_count ) )
+    {
+        m_peaks.push_back( read( mountain.peak ) );
+    }
+}
+
+std::uint64_t Blockchain::Accumulator::getSize( const std::uint64_t count )
+{
+    return 2 * count - static_cast<std::uint64_t>( __builtin_popcountll( count ) );
+}
+
+Blockchain::Block::Sha256 Blockchain::Accumulator::merge( const Block::Sha256 & left,
+                                                          const Block::Sha256 & right )
+{
+    char pair[ 2 * kHashSize ];
+    Block::Sha256 result{};
+
+    std::copy( left.begin(), left.end(), pair );
+    std::copy( right.begin(), right.end(), pair + kHashSize );
+    Hasher::hash( pair, sizeof( pair ), result.data() );
+
+    return result;
+}
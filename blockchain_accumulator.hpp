@@ -0,0 +1,59 @@
+#pragma once
+
+#include "blockchain_block.hpp"
+
+namespace bitchat {
+
+//! Merkle mountain range over the block hashes, the nodes are stored in post order
+//! so the range over any prefix of the chain is a prefix of the file
+class Blockchain::Accumulator : private boost::noncopyable
+{
+    static constexpr auto kHashSize{ sizeof( Block::Sha256 ) };
+
+public:
+    using Proof = std::vector<Block::Sha256>;
+
+    explicit Accumulator( const std::string & path );
+    ~Accumulator();
+
+    std::uint64_t open();
+    void close();
+    void truncate( const std::uint64_t count );
+    std::uint64_t getCount() const;
+
+    void append( const Block::Sha256 & hash );
+    void flush();
+
+    //! The root over the first count leaves
+    Block::Sha256 getRoot( const std::uint64_t count );
+
+    //! The siblings from the leaf up to its peak followed by the peaks on the left
+    //! and the bagged peaks on the right, if any
+    Proof prove( const std::uint64_t index,
+                 const std::uint64_t count );
+
+    static bool verify( const Block::Sha256 & hash,
+                        const std::uint64_t index,
+                        const std::uint64_t count,
+                        const Proof & proof,
+                        const Block::Sha256 & root );
+
+private:
+    Block::Sha256 read( const std::uint64_t position );
+    void loadPeaks();
+
+    static std::uint64_t getSize( const std::uint64_t count );
+    static Block::Sha256 merge( const Block::Sha256 & left,
+                                const Block::Sha256 & right );
+
+private:
+    const std::string m_path;
+    int m_descriptor;
+    std::uint64_t m_count;
+    std::uint64_t m_size;
+    std::vector<Block::Sha256> m_peaks;
+    std::string m_pending;
+    std::mutex m_mutex;
+};
+
+} // bitchat
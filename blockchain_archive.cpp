@@ -0,0 +1,227 @@
+#include "blockchain_archive.hpp"
+#include <boost/log/trivial.hpp>
+#include <zlib.h>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+using bitchat::Blockchain;
+
+namespace
+{
+//! The archive is a sequence of independently deflated frames followed by
+//! the table of frame offsets and the trailer which locates the table
+constexpr char kMagic[ 8 ]{ 'B', 'C', 'H', 'A', 'I', 'N', 'Z', '1' };
+
+#pragma pack(push, 1)
+
+struct Trailer
+{
+    std::uint64_t table;
+    std::uint64_t frames;
+    std::uint64_t blocks;
+    std::uint32_t frameBlocks;
+    std::uint32_t blockSize;
+    char magic[ sizeof( kMagic ) ];
+};
+
+#pragma pack(pop)
+
+void writeAll( const int descriptor,
+               const char * data,
+               std::size_t size )
+{
+    while ( size > 0 )
+    {
+        const auto written{ ::write( descriptor, data, size ) };
+
+        if ( written <= 0 )
+        {
+            throw std::runtime_error( "Failed to write the blockchain archive" );
+        }
+
+        data += written;
+        size -= static_cast<std::size_t>( written );
+    }
+}
+}
+
+Blockchain::Archive::Archive( const std::string & path ) :
+    m_path{ path },
+    m_descriptor{ -1 },
+    m_count{ 0 },
+    m_frameBlocks{ kFrameBlocks },
+    m_frame{ 0 }
+{
+}
+
+Blockchain::Archive::~Archive()
+{
+    close();
+}
+
+void Blockchain::Archive::create( const std::string & source,
+                                  const std::string & path )
+{
+    const auto temporary{ path + ".tmp" };
+    const auto input{ ::open( source.c_str(), O_RDONLY ) };
+    const auto output{ ::open( temporary.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0640 ) };
+    const auto frameSize{ kFrameBlocks * getBlockSize() };
+    std::string frame( frameSize, '\0' );
+    std::string compressed( compressBound( frameSize ), '\0' );
+    std::vector<std::uint64_t> offsets{ 0 };
+    Trailer trailer{};
+
+    try
+    {
+        if ( input < 0 || output < 0 )
+        {
+            throwLastError( "Failed to open the blockchain archive" );
+        }
+
+        for ( ;; )
+        {
+            const auto readed{ ::pread64( input, & frame[ 0 ], frameSize,
+                                          static_cast<std::int64_t>( trailer.blocks * getBlockSize() ) ) };
+            const auto blocks{ readed > 0 ? static_cast<std::size_t>( readed ) / getBlockSize() : 0 };
+            auto size{ static_cast<uLongf>( compressed.size() ) };
+
+            if ( blocks == 0 )
+            {
+                break;
+            }
+
+            if ( ::compress2( reinterpret_cast<Bytef *>( & compressed[ 0 ] ), & size,
+                              reinterpret_cast<const Bytef *>( frame.data() ), blocks * getBlockSize(),
+                              Z_DEFAULT_COMPRESSION ) != Z_OK )
+            {
+                throw std::runtime_error( "Failed to compress the blockchain archive" );
+            }
+
+            writeAll( output, compressed.data(), size );
+            offsets.push_back( offsets.back() + size );
+            trailer.blocks += blocks;
+        }
+
+        trailer.table = offsets.back();
+        trailer.frames = offsets.size() - 1;
+        trailer.frameBlocks = kFrameBlocks;
+        trailer.blockSize = static_cast<std::uint32_t>( getBlockSize() );
+        std::memcpy( trailer.magic, kMagic, sizeof( kMagic ) );
+
+        writeAll( output, reinterpret_cast<const char *>( offsets.data() ), offsets.size() * sizeof( offsets[ 0 ] ) );
+        writeAll( output, reinterpret_cast<const char *>( & trailer ), sizeof( trailer ) );
+
+        if ( ::fsync( output ) != 0 || ::rename( temporary.c_str(), path.c_str() ) != 0 )
+        {
+            throwLastError( "Failed to store the blockchain archive" );
+        }
+    }
+    catch ( ... )
+    {
+        ::close( input );
+        ::close( output );
+        ::remove( temporary.c_str() );
+        throw;
+    }
+
+    ::close( input );
+    ::close( output );
+    BOOST_LOG_TRIVIAL( info ) << "Archived " << trailer.blocks << " blocks of " << source
+                              << " into " << trailer.table << " bytes";
+}
+
+std::uint64_t Blockchain::Archive::open()
+{
+    Trailer trailer{};
+
+    m_descriptor = ::open( m_path.c_str(), O_RDONLY );
+
+    if ( m_descriptor < 0 )
+    {
+        throwLastError( "Failed to open the blockchain archive" );
+    }
+
+    const auto length{ ::lseek64( m_descriptor, 0, SEEK_END ) };
+    const auto position{ length - static_cast<std::int64_t>( sizeof( trailer ) ) };
+
+    if ( position < 0 ||
+         ::pread64( m_descriptor, & trailer, sizeof( trailer ), position ) != sizeof( trailer ) ||
+         std::memcmp( trailer.magic, kMagic, sizeof( kMagic ) ) != 0 ||
+         trailer.blockSize != getBlockSize() ||
+         trailer.frameBlocks == 0 )
+    {
+        throw std::runtime_error( "The blockchain archive " + m_path + " is invalid" );
+    }
+
+    const auto tableSize{ ( trailer.frames + 1 ) * sizeof( std::uint64_t ) };
+
+    m_offsets.resize( trailer.frames + 1 );
+
+    if ( ::pread64( m_descriptor, m_offsets.data(), tableSize, static_cast<std::int64_t>( trailer.table ) ) !=
+         static_cast<ssize_t>( tableSize ) )
+    {
+        throw std::runtime_error( "The blockchain archive " + m_path + " is truncated" );
+    }
+
+    m_count = trailer.blocks;
+    m_frameBlocks = trailer.frameBlocks;
+    m_frame = m_offsets.size();
+    m_frameData.resize( m_frameBlocks * getBlockSize() );
+
+    return m_count;
+}
+
+void Blockchain::Archive::close()
+{
+    if ( m_descriptor >= 0 )
+    {
+        ::close( m_descriptor );
+        m_descriptor = -1;
+    }
+
+    m_count = 0;
+    m_offsets.clear();
+    m_frameData.clear();
+}
+
+bool Blockchain::Archive::read( const std::uint64_t index,
+                                Block & block )
+{
+    const auto frame{ index / m_frameBlocks };
+
+    if ( index >= m_count )
+    {
+        return false;
+    }
+
+    //! The frame kept is shared by the reads of every thread
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    //! The last decompressed frame is kept, so sequential reads inflate every frame once
+    if ( frame != m_frame )
+    {
+        const auto size{ m_offsets[ frame + 1 ] - m_offsets[ frame ] };
+        auto length{ static_cast<uLongf>( m_frameData.size() ) };
+
+        m_compressed.resize( size );
+
+        if ( ::pread64( m_descriptor, & m_compressed[ 0 ], size, static_cast<std::int64_t>( m_offsets[ frame ] ) ) !=
+             static_cast<ssize_t>( size ) ||
+             ::uncompress( reinterpret_cast<Bytef *>( & m_frameData[ 0 ] ), & length,
+                           reinterpret_cast<const Bytef *>( m_compressed.data() ), size ) != Z_OK )
+        {
+            m_frame = m_offsets.size();
+            BOOST_LOG_TRIVIAL( error ) << "Failed to read frame " << frame << " of " << m_path;
+            return false;
+        }
+
+        m_frame = frame;
+    }
+
+    std::memcpy( block.getRawPointer(),
+                 m_frameData.data() + ( index % m_frameBlocks ) * getBlockSize(),
+                 getBlockSize() );
+
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "blockchain_block.hpp"
+
+namespace bitchat {
+
+class Blockchain::Archive : private boost::noncopyable
+{
+public:
+    static constexpr auto kFrameBlocks{ 256 };
+
+    explicit Archive( const std::string & path );
+    ~Archive();
+
+    static void create( const std::string & source,
+                        const std::string & path );
+
+    std::uint64_t open();
+    void close();
+
+    bool read( const std::uint64_t index,
+               Block & block );
+
+private:
+    const std::string m_path;
+    int m_descriptor;
+    std::uint64_t m_count;
+    std::uint64_t m_frameBlocks;
+    std::vector<std::uint64_t> m_offsets;
+    std::uint64_t m_frame;
+    std::string m_frameData;
+    std::string m_compressed;
+    std::mutex m_mutex;
+};
+
+} // bitchat
@@ -1,54 +1,94 @@
 #include "blockchain_block.hpp"
+#include "hasher.hpp"
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <cstddef>
+#include <cstring>
 
 using bitchat::Blockchain;
 
+Blockchain::Head::Head( const Block & head,
+                        const std::string & value ) :
+    block{ head },
+    hash{ head.calculateHash() },
+    value{ value }
+{
+}
 
-Blockchain::Block::Sha256 Blockchain::Block::calculateHash() const
+template <std::size_t KeySize, std::size_t ValueSize>
+typename Blockchain::BasicBlock<KeySize, ValueSize>::Sha256
+Blockchain::BasicBlock<KeySize, ValueSize>::calculateHash() const
 {
     Sha256 result{};
-    const auto begin{ getRawPointer() };
-    const auto end{ begin + getSize() };
 
-    picosha2::hash256( begin, end, result.begin(), result.end() );
+    Hasher::hash( getRawPointer(), kSize, result.data() );
 
     return result;
 }
 
-char * Blockchain::Block::getRawPointer()
+template <std::size_t KeySize, std::size_t ValueSize>
+void Blockchain::BasicBlock<KeySize, ValueSize>::hashBlocks( const BasicBlock * blocks,
+                                                             const std::size_t count,
+                                                             Sha256 * hashes )
+{
+    static_assert( sizeof( Sha256 ) == Hasher::kDigestSize, "Unexpected digest size" );
+
+    Hasher::hash( blocks->getRawPointer(), kSize, kSize, count, hashes->data() );
+}
+
+template <std::size_t KeySize, std::size_t ValueSize>
+char * Blockchain::BasicBlock<KeySize, ValueSize>::getRawPointer()
 {
     return reinterpret_cast<char *>( this );
 }
 
-const char *Blockchain::Block::getRawPointer() const
+template <std::size_t KeySize, std::size_t ValueSize>
+const char * Blockchain::BasicBlock<KeySize, ValueSize>::getRawPointer() const
 {
     return reinterpret_cast<const char *>( this );
 }
 
-std::size_t Blockchain::Block::getSize()
+template <std::size_t KeySize, std::size_t ValueSize>
+std::size_t Blockchain::BasicBlock<KeySize, ValueSize>::getSize()
 {
-    return sizeof( Block );
+    static_assert( offsetof( BasicBlock, index ) == kIndexOffset &&
+                   offsetof( BasicBlock, timestamp ) == kTimestampOffset &&
+                   offsetof( BasicBlock, key ) == kKeyOffset &&
+                   offsetof( BasicBlock, value ) == kValueOffset &&
+                   offsetof( BasicBlock, previousHash ) == kPreviousHashOffset &&
+                   offsetof( BasicBlock, nonce ) == kNonceOffset &&
+                   offsetof( BasicBlock, difficult ) == kDifficultOffset,
+                   "The block fields don't match the layout" );
+    static_assert( sizeof( BasicBlock ) == kSize, "The block must be packed" );
+
+    return kSize;
 }
 
-std::string Blockchain::Block::convertToString( const Sha256 & hash )
+template <std::size_t KeySize, std::size_t ValueSize>
+std::string Blockchain::BasicBlock<KeySize, ValueSize>::convertToString( const Sha256 & hash )
 {
     return picosha2::bytes_to_hex_string( hash.begin(), hash.end() );
 }
 
-std::string Blockchain::Block::convertToString( const Value & value )
+template <std::size_t KeySize, std::size_t ValueSize>
+std::string Blockchain::BasicBlock<KeySize, ValueSize>::convertToString( const Value & value )
 {
-    return std::string{ value.data() };
+    //! A value filling the whole field has no terminating zero
+    return std::string{ value.data(), ::strnlen( value.data(), value.size() ) };
 }
 
-std::string Blockchain::Block::convertToString( const Blockchain::Block::Key & key )
+template <std::size_t KeySize, std::size_t ValueSize>
+std::string Blockchain::BasicBlock<KeySize, ValueSize>::convertToString( const Key & key )
 {
-    return std::string{ key.data() };
+    return std::string{ key.data(), ::strnlen( key.data(), key.size() ) };
 }
 
-std::int64_t Blockchain::Block::getCurrentTimestamp()
+template <std::size_t KeySize, std::size_t ValueSize>
+std::int64_t Blockchain::BasicBlock<KeySize, ValueSize>::getCurrentTimestamp()
 {
     const auto epoch{ boost::posix_time::from_time_t( 0 ) };
     const auto now{ boost::posix_time::microsec_clock::universal_time() };
     const auto timestamp{ now - epoch };
     return timestamp.total_milliseconds();
 }
+
+template struct Blockchain::BasicBlock<Blockchain::kKeySize, Blockchain::kValueSize>;
@@ -7,11 +7,24 @@ namespace bitchat {
 
 #pragma pack(push, 1)
 
-struct Blockchain::Block
+template <std::size_t KeySize, std::size_t ValueSize>
+struct Blockchain::BasicBlock
 {
     using Sha256 = std::array<char, picosha2::k_digest_size>;
-    using Value = std::array<char, Blockchain::kValueSize>;
-    using Key = std::array<char, Blockchain::kKeySize>;
+    using Value = std::array<char, ValueSize>;
+    using Key = std::array<char, KeySize>;
+
+    //! The packed layout, getSize checks it against the fields
+    static constexpr std::size_t kIndexOffset{ 0 };
+    static constexpr std::size_t kTimestampOffset{ kIndexOffset + sizeof( std::uint64_t ) };
+    static constexpr std::size_t kKeyOffset{ kTimestampOffset + sizeof( std::int64_t ) };
+    static constexpr std::size_t kValueOffset{ kKeyOffset + KeySize };
+    static constexpr std::size_t kPreviousHashOffset{ kValueOffset + ValueSize };
+    static constexpr std::size_t kNonceOffset{ kPreviousHashOffset + picosha2::k_digest_size };
+    static constexpr std::size_t kDifficultOffset{ kNonceOffset + sizeof( std::uint64_t ) };
+    static constexpr std::size_t kSize{ kDifficultOffset + sizeof( std::uint8_t ) };
+
+    static_assert( KeySize > 0 && ValueSize > 0, "The key and the value must not be empty" );
 
 //    std::size_t getIndex() const;
 //    std::uint64_t getTimestamp() const;
@@ -27,6 +40,10 @@ struct Blockchain::Block
 
     Sha256 calculateHash() const;
 
+    static void hashBlocks( const BasicBlock * blocks,
+                            const std::size_t count,
+                            Sha256 * hashes );
+
     char * getRawPointer();
     const char * getRawPointer() const;
 
@@ -38,7 +55,7 @@ struct Blockchain::Block
 
 
 //private:
-//    Block();
+//    BasicBlock();
 
 //private:
     std::uint64_t index;
@@ -46,11 +63,46 @@ struct Blockchain::Block
     Key key;
     Value value;
     Sha256 previousHash;
-//    std::int64_t nonce;
-//    std::uint8_t difficult;
+    std::uint64_t nonce;
+    std::uint8_t difficult;     //! leading zero bits required of the block hash
+};
+
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+
+//! What a peer needs to link a block before fetching it
+struct Blockchain::Header
+{
+    std::uint64_t index;
+    std::int64_t timestamp;
+    Block::Sha256 previousHash;
+    Block::Sha256 hash;
 };
 
 #pragma pack(pop)
 
+#pragma pack(push, 1)
+
+struct Blockchain::Checkpoint
+{
+    std::uint64_t index;    //! the last verified block
+    std::uint64_t length;   //! the chain length in bytes when it was verified
+    Block::Sha256 hash;     //! the hash of the last verified block
+    std::uint64_t valueTail;    //! the end of the value heap as of that block
+};
+
+#pragma pack(pop)
+
+struct Blockchain::Head
+{
+    explicit Head( const Block & head,
+                   const std::string & value = std::string{} );
+
+    const Block block;
+    const Block::Sha256 hash;
+    const std::string value;    //! the value to put in the value heap, empty when it's inlined
+};
+
 } // bitchat
 
@@ -0,0 +1,125 @@
+#include "blockchain_filestore.hpp"
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+
+using bitchat::Blockchain;
+
+Blockchain::FileStore::FileStore( const std::string & path ) :
+    m_path{ path },
+    m_descriptor{ -1 }
+{
+}
+
+Blockchain::FileStore::~FileStore()
+{
+    FileStore::close();
+}
+
+std::uint64_t Blockchain::FileStore::open( const bool sealed )
+{
+    struct stat status{};
+
+    m_descriptor = ::open( m_path.c_str(), sealed ? O_RDONLY : O_CREAT | O_RDWR, 0640 );
+
+    if ( m_descriptor < 0 || ::fstat( m_descriptor, & status ) != 0 )
+    {
+        throwLastError( "Failed to open the blockchain segment" );
+    }
+
+    return static_cast<std::uint64_t>( status.st_size );
+}
+
+void Blockchain::FileStore::close()
+{
+    if ( m_descriptor >= 0 )
+    {
+        ::close( m_descriptor );
+        m_descriptor = -1;
+    }
+}
+
+void Blockchain::FileStore::sync()
+{
+    if ( m_descriptor >= 0 && ::fdatasync( m_descriptor ) != 0 )
+    {
+        throwLastError( "Failed to sync the blockchain segment" );
+    }
+}
+
+void Blockchain::FileStore::truncate( const std::uint64_t size )
+{
+    if ( ::ftruncate64( m_descriptor, static_cast<std::int64_t>( size ) ) != 0 )
+    {
+        throwLastError( "Failed to truncate the blockchain segment" );
+    }
+}
+
+std::uint64_t Blockchain::FileStore::read( const std::uint64_t offset,
+                                           const std::uint64_t size,
+                                           char * data )
+{
+    //! A single pread unless it comes back short
+    std::uint64_t done{ 0 };
+
+    while ( done < size )
+    {
+        const auto result{ ::pread64( m_descriptor, data + done, size - done,
+                                      static_cast<std::int64_t>( offset + done ) ) };
+
+        if ( result <= 0 )
+        {
+            break;
+        }
+
+        done += static_cast<std::uint64_t>( result );
+    }
+
+    return done;
+}
+
+void Blockchain::FileStore::write( const std::uint64_t offset,
+                                   const HeadPtr * heads,
+                                   const std::size_t count )
+{
+    std::vector<iovec> vectors{};
+    auto length{ offset };
+
+    vectors.reserve( count );
+
+    for ( auto i{ 0ull }; i < count; ++i )
+    {
+        vectors.push_back( iovec{ const_cast<char *>( heads[ i ]->block.getRawPointer() ), getBlockSize() } );
+    }
+
+    for ( auto it{ vectors.begin() }; it != vectors.end(); )
+    {
+        const auto size{ std::min<std::ptrdiff_t>( vectors.end() - it, IOV_MAX ) };
+        auto written{ ::pwritev64( m_descriptor, & * it, size, static_cast<std::int64_t>( length ) ) };
+
+        if ( written < 0 )
+        {
+            throwLastError( "Failed to write blocks" );
+        }
+
+        length += written;
+
+        for ( ; it != vectors.end() && static_cast<std::size_t>( written ) >= it->iov_len; ++it )
+        {
+            written -= it->iov_len;
+        }
+
+        if ( written > 0 )
+        {
+            it->iov_base = static_cast<char *>( it->iov_base ) + written;
+            it->iov_len -= written;
+        }
+    }
+}
+
+int Blockchain::FileStore::getDescriptor() const
+{
+    return m_descriptor;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "blockchain_store.hpp"
+
+namespace bitchat {
+
+class Blockchain::FileStore : public Store
+{
+public:
+    explicit FileStore( const std::string & path );
+    ~FileStore() override;
+
+    std::uint64_t open( const bool sealed ) override;
+    void close() override;
+    void sync() override;
+    void truncate( const std::uint64_t size ) override;
+
+    std::uint64_t read( const std::uint64_t offset,
+                        const std::uint64_t size,
+                        char * data ) override;
+    void write( const std::uint64_t offset,
+                const HeadPtr * heads,
+                const std::size_t count ) override;
+
+    int getDescriptor() const override;
+
+private:
+    const std::string m_path;
+    int m_descriptor;
+};
+
+} // bitchat
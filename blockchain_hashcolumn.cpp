@@ -0,0 +1,108 @@
+#include "blockchain_hashcolumn.hpp"
+#include <boost/log/trivial.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+
+using bitchat::Blockchain;
+
+Blockchain::HashColumn::HashColumn( const std::string & path ) :
+    m_path{ path },
+    m_descriptor{ -1 },
+    m_count{ 0 }
+{
+}
+
+Blockchain::HashColumn::~HashColumn()
+{
+    close();
+}
+
+std::uint64_t Blockchain::HashColumn::open()
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    m_descriptor = openFile( m_path, O_CREAT | O_RDWR | O_APPEND );
+
+    if ( m_descriptor < 0 )
+    {
+        throwLastError( "Failed to open the hash column" );
+    }
+
+    const auto length{ static_cast<std::uint64_t>( ::lseek64( m_descriptor, 0, SEEK_END ) ) };
+
+    m_count = length / kHashSize;
+
+    if ( length % kHashSize != 0 )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Dropped a torn hash at " << m_count;
+        ::ftruncate64( m_descriptor, static_cast<std::int64_t>( m_count * kHashSize ) );
+    }
+
+    return m_count;
+}
+
+void Blockchain::HashColumn::close()
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    if ( m_descriptor >= 0 )
+    {
+        ::close( m_descriptor );
+        m_descriptor = -1;
+    }
+
+    m_count = 0;
+    m_pending.clear();
+}
+
+void Blockchain::HashColumn::truncate( const std::uint64_t count )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    if ( ::ftruncate64( m_descriptor, static_cast<std::int64_t>( count * kHashSize ) ) != 0 )
+    {
+        throwLastError( "Failed to truncate the hash column" );
+    }
+
+    m_count = count;
+    m_pending.clear();
+}
+
+std::uint64_t Blockchain::HashColumn::getCount() const
+{
+    return m_count;
+}
+
+void Blockchain::HashColumn::append( const Block::Sha256 & hash )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    m_pending.append( hash.begin(), hash.end() );
+}
+
+void Blockchain::HashColumn::flush()
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    if ( ! m_pending.empty() )
+    {
+        if ( ::write( m_descriptor, m_pending.data(), m_pending.size() ) !=
+             static_cast<ssize_t>( m_pending.size() ) )
+        {
+            throwLastError( "Failed to write the hash column" );
+        }
+
+        m_count += m_pending.size() / kHashSize;
+        m_pending.clear();
+    }
+}
+
+bool Blockchain::HashColumn::get( const std::uint64_t index,
+                                  Block::Sha256 & hash )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+    const auto position{ static_cast<std::int64_t>( index * kHashSize ) };
+
+    return index < m_count &&
+           ::pread64( m_descriptor, hash.data(), kHashSize, position ) == static_cast<ssize_t>( kHashSize );
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "blockchain_block.hpp"
+
+namespace bitchat {
+
+class Blockchain::HashColumn : private boost::noncopyable
+{
+    static constexpr auto kHashSize{ sizeof( Block::Sha256 ) };
+
+public:
+    explicit HashColumn( const std::string & path );
+    ~HashColumn();
+
+    std::uint64_t open();
+    void close();
+    void truncate( const std::uint64_t count );
+    std::uint64_t getCount() const;
+
+    void append( const Block::Sha256 & hash );
+    void flush();
+
+    bool get( const std::uint64_t index,
+              Block::Sha256 & hash );
+
+private:
+    const std::string m_path;
+    int m_descriptor;
+    std::uint64_t m_count;
+    std::string m_pending;
+    std::mutex m_mutex;
+};
+
+} // bitchat
@@ -0,0 +1,69 @@
+#include "blockchain_iterator.hpp"
+
+using bitchat::Blockchain;
+
+namespace
+{
+constexpr auto kReadAhead{ 1024 }; //! blocks per chunk
+}
+
+Blockchain::Iterator::Iterator( Blockchain & blockchain,
+                                const std::uint64_t index ) :
+    m_blockchain{ & blockchain },
+    m_index{ index },
+    m_first{ index }
+{
+}
+
+std::uint64_t Blockchain::Iterator::getIndex() const
+{
+    return m_index;
+}
+
+Blockchain::Iterator::reference Blockchain::Iterator::operator*() const
+{
+    if ( ! m_chunk || m_index < m_first || ( m_index - m_first + 1 ) * getBlockSize() > m_chunk->size() )
+    {
+        load();
+    }
+
+    BOOST_ASSERT( ( m_index - m_first + 1 ) * getBlockSize() <= m_chunk->size() );
+
+    return m_chunk->data() + ( m_index - m_first ) * getBlockSize();
+}
+
+Blockchain::Iterator & Blockchain::Iterator::operator++()
+{
+    ++m_index;
+
+    return * this;
+}
+
+Blockchain::Iterator Blockchain::Iterator::operator++( int )
+{
+    const auto result{ * this };
+
+    ++( * this );
+
+    return result;
+}
+
+bool Blockchain::Iterator::operator==( const Iterator & other ) const
+{
+    return m_blockchain == other.m_blockchain && m_index == other.m_index;
+}
+
+bool Blockchain::Iterator::operator!=( const Iterator & other ) const
+{
+    return ! ( * this == other );
+}
+
+void Blockchain::Iterator::load() const
+{
+    //! A new chunk is allocated every time, the copies keep their own
+    auto chunk{ std::make_shared<std::string>( kReadAhead * getBlockSize(), '\0' ) };
+
+    chunk->resize( m_blockchain->loadBlocks( m_index, kReadAhead, & chunk->front() ) * getBlockSize() );
+    m_first = m_index;
+    m_chunk = chunk;
+}
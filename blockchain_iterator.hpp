@@ -0,0 +1,42 @@
+#pragma once
+
+#include "blockchain.hpp"
+#include <iterator>
+
+namespace bitchat {
+
+//! Walks the raw blocks reading them ahead in large chunks, a block pointer
+//! stays valid as long as the iterator or any copy of it stays on its chunk
+class Blockchain::Iterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = const char *;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type *;
+    using reference = value_type;
+
+    Iterator( Blockchain & blockchain,
+              const std::uint64_t index );
+
+    std::uint64_t getIndex() const;
+
+    reference operator*() const;
+    Iterator & operator++();
+    Iterator operator++( int );
+
+    bool operator==( const Iterator & other ) const;
+    bool operator!=( const Iterator & other ) const;
+
+private:
+    void load() const;
+
+private:
+    Blockchain * m_blockchain;
+    std::uint64_t m_index;
+    //! The chunk is loaded on the first access, so comparing with end() costs nothing
+    mutable std::uint64_t m_first;
+    mutable std::shared_ptr<const std::string> m_chunk;
+};
+
+} // bitchat
@@ -0,0 +1,358 @@
+#include "blockchain_keyindex.hpp"
+#include "blockchain_block.hpp"
+#include <boost/log/trivial.hpp>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+using bitchat::Blockchain;
+
+namespace
+{
+//! The file starts with the magic. Every record is a varint key id + 1 and a varint
+//! delta from the previous block of the same key (index + 1 for the first one).
+//! A key is written out once, in its first record, where the id is 0 followed by
+//! a varint key length and the key bytes; the ids follow the order of those records
+constexpr char kMagic[ 8 ]{ 'B', 'C', 'K', 'E', 'Y', 'S', '0', '2' };
+
+//! The snapshot is the magic, the varint count of blocks and the varint length of the
+//! log it covers, and every key in the order of the ids: a varint length, the key bytes,
+//! the varint last block and the varint length of the deltas followed by them
+constexpr char kSnapshotMagic[ 8 ]{ 'B', 'C', 'K', 'S', 'N', 'A', 'P', '1' };
+
+void appendVarint( std::string & output,
+                   std::uint64_t value )
+{
+    for ( ; value >= 0x80; value >>= 7 )
+    {
+        output += static_cast<char>( ( value & 0x7f ) | 0x80 );
+    }
+    output += static_cast<char>( value );
+}
+
+bool extractVarint( const std::string & input,
+                    std::size_t & position,
+                    std::uint64_t & value )
+{
+    value = 0;
+
+    for ( auto shift{ 0u }; position < input.size() && shift < 64; shift += 7 )
+    {
+        const auto byte{ static_cast<std::uint8_t>( input[ position++ ] ) };
+
+        value |= static_cast<std::uint64_t>( byte & 0x7f ) << shift;
+
+        if ( ( byte & 0x80 ) == 0 )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+}
+
+Blockchain::KeyIndex::KeyIndex( const std::string & path ) :
+    m_path{ path },
+    m_descriptor{ -1 },
+    m_count{ 0 }
+{
+}
+
+Blockchain::KeyIndex::~KeyIndex()
+{
+    close();
+}
+
+std::uint64_t Blockchain::KeyIndex::open( const std::uint64_t limit )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+    char magic[ sizeof( kMagic ) ]{};
+
+    m_descriptor = openFile( m_path, O_CREAT | O_RDWR | O_APPEND );
+
+    if ( m_descriptor < 0 )
+    {
+        throwLastError( "Failed to open the key index" );
+    }
+
+    auto size{ static_cast<std::uint64_t>( ::lseek64( m_descriptor, 0, SEEK_END ) ) };
+
+    //! An index of the former format, with the key in every record, is built anew
+    if ( ::pread64( m_descriptor, magic, sizeof( magic ), 0 ) != static_cast<ssize_t>( sizeof( magic ) ) ||
+         std::memcmp( magic, kMagic, sizeof( kMagic ) ) != 0 )
+    {
+        if ( size > 0 )
+        {
+            BOOST_LOG_TRIVIAL( warning ) << "Rebuilding the key index of the former format";
+        }
+
+        if ( ::ftruncate64( m_descriptor, 0 ) != 0 ||
+             ::write( m_descriptor, kMagic, sizeof( kMagic ) ) != static_cast<ssize_t>( sizeof( kMagic ) ) )
+        {
+            throwLastError( "Failed to write the key index" );
+        }
+
+        size = sizeof( kMagic );
+    }
+
+    //! Only the records written after the snapshot are replayed
+    const auto begin{ load( limit, size ) };
+    std::string data( static_cast<std::size_t>( size - begin ), '\0' );
+
+    if ( ::pread64( m_descriptor, & data[ 0 ], data.size(), static_cast<std::int64_t>( begin ) ) !=
+         static_cast<ssize_t>( data.size() ) )
+    {
+        throwLastError( "Failed to read the key index" );
+    }
+
+    std::size_t position{ 0 };
+    std::size_t complete{ 0 };
+    std::uint64_t id{ 0 };
+    std::uint64_t length{ 0 };
+    std::uint64_t delta{ 0 };
+    std::string key{};
+
+    //! Records past the limit describe blocks which are no longer in the chain
+    while ( m_count < limit && extractVarint( data, position, id ) )
+    {
+        if ( id == 0 )
+        {
+            if ( ! extractVarint( data, position, length ) || position + length > data.size() )
+            {
+                break;
+            }
+
+            key = data.substr( position, length );
+            position += length;
+        }
+        else if ( id > m_ids.size() )
+        {
+            break;
+        }
+
+        if ( ! extractVarint( data, position, delta ) )
+        {
+            break;
+        }
+
+        insert( id == 0 ? addKey( key ) : m_ids[ id - 1 ]->second, delta );
+        complete = position;
+    }
+
+    if ( complete < data.size() )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Truncated the key index at " << m_count << " blocks";
+        ::ftruncate64( m_descriptor, static_cast<std::int64_t>( begin + complete ) );
+    }
+
+    return m_count;
+}
+
+void Blockchain::KeyIndex::close()
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    if ( m_descriptor >= 0 )
+    {
+        save();
+        ::close( m_descriptor );
+        m_descriptor = -1;
+    }
+
+    m_count = 0;
+    m_records.clear();
+    m_postings.clear();
+    m_ids.clear();
+}
+
+void Blockchain::KeyIndex::append( const Block & block )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+    const auto key{ Block::convertToString( block.key ) };
+    const auto it{ m_postings.find( key ) };
+
+    if ( it == m_postings.end() )
+    {
+        appendVarint( m_records, 0 );
+        appendVarint( m_records, key.size() );
+        m_records += key;
+        appendVarint( m_records, m_count + 1 );
+        insert( addKey( key ), m_count + 1 );
+    }
+    else
+    {
+        const auto delta{ m_count - it->second.last };
+
+        appendVarint( m_records, it->second.id + 1 );
+        appendVarint( m_records, delta );
+        insert( it->second, delta );
+    }
+}
+
+void Blockchain::KeyIndex::flush()
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    if ( ! m_records.empty() )
+    {
+        if ( ::write( m_descriptor, m_records.data(), m_records.size() ) !=
+             static_cast<ssize_t>( m_records.size() ) )
+        {
+            throwLastError( "Failed to write the key index" );
+        }
+
+        m_records.clear();
+    }
+}
+
+std::vector<std::uint64_t> Blockchain::KeyIndex::find( const std::string & key ) const
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+    std::vector<std::uint64_t> result{};
+    const auto it{ m_postings.find( key ) };
+
+    if ( it != m_postings.end() )
+    {
+        std::size_t position{ 0 };
+        std::uint64_t delta{ 0 };
+        std::uint64_t index{ 0 };
+
+        while ( extractVarint( it->second.deltas, position, delta ) )
+        {
+            index = result.empty() ? delta - 1 : index + delta;
+            result.push_back( index );
+        }
+    }
+
+    return result;
+}
+
+std::uint64_t Blockchain::KeyIndex::load( const std::uint64_t limit,
+                                          const std::uint64_t size )
+{
+    //! Expects m_mutex to be locked by the caller. Returns where the log goes on after
+    //! the snapshot, a snapshot which doesn't fit the log and the chain is dropped
+    const auto path{ m_path + ".snapshot" };
+    const auto descriptor{ m_path.empty() ? -1 : ::open( path.c_str(), O_RDONLY ) };
+    std::string data{};
+    std::size_t position{ sizeof( kSnapshotMagic ) };
+    std::uint64_t count{ 0 };
+    std::uint64_t offset{ 0 };
+    std::uint64_t keys{ 0 };
+
+    if ( descriptor < 0 )
+    {
+        return sizeof( kMagic );
+    }
+
+    data.resize( static_cast<std::size_t>( ::lseek64( descriptor, 0, SEEK_END ) ) );
+
+    const auto readed{ ::pread64( descriptor, & data[ 0 ], data.size(), 0 ) };
+
+    ::close( descriptor );
+
+    if ( readed == static_cast<ssize_t>( data.size() ) &&
+         data.size() >= sizeof( kSnapshotMagic ) &&
+         std::memcmp( data.data(), kSnapshotMagic, sizeof( kSnapshotMagic ) ) == 0 &&
+         extractVarint( data, position, count ) && count <= limit &&
+         extractVarint( data, position, offset ) && offset >= sizeof( kMagic ) && offset <= size &&
+         extractVarint( data, position, keys ) )
+    {
+        for ( ; keys > 0; --keys )
+        {
+            std::uint64_t length{ 0 };
+            std::uint64_t last{ 0 };
+
+            if ( ! extractVarint( data, position, length ) || position + length > data.size() )
+            {
+                break;
+            }
+
+            auto & postings{ addKey( data.substr( position, length ) ) };
+
+            position += length;
+
+            if ( ! extractVarint( data, position, last ) ||
+                 ! extractVarint( data, position, length ) || position + length > data.size() )
+            {
+                break;
+            }
+
+            postings.last = last;
+            postings.deltas = data.substr( position, length );
+            position += length;
+        }
+
+        if ( keys == 0 && position == data.size() )
+        {
+            m_count = count;
+            return offset;
+        }
+    }
+
+    BOOST_LOG_TRIVIAL( warning ) << "Dropped the key index snapshot which doesn't match the chain";
+    ::remove( path.c_str() );
+    m_postings.clear();
+    m_ids.clear();
+
+    return sizeof( kMagic );
+}
+
+void Blockchain::KeyIndex::save()
+{
+    //! Expects m_mutex to be locked by the caller. The snapshot covers the log as it is,
+    //! the records not flushed yet are left to be replayed
+    const auto path{ m_path + ".snapshot" };
+    const auto temporary{ path + ".tmp" };
+    const auto size{ ::lseek64( m_descriptor, 0, SEEK_END ) };
+    std::string data( kSnapshotMagic, sizeof( kSnapshotMagic ) );
+
+    if ( m_path.empty() || ! m_records.empty() || size < 0 )
+    {
+        return;
+    }
+
+    appendVarint( data, m_count );
+    appendVarint( data, static_cast<std::uint64_t>( size ) );
+    appendVarint( data, m_ids.size() );
+
+    for ( const auto entry : m_ids )
+    {
+        appendVarint( data, entry->first.size() );
+        data += entry->first;
+        appendVarint( data, entry->second.last );
+        appendVarint( data, entry->second.deltas.size() );
+        data += entry->second.deltas;
+    }
+
+    const auto descriptor{ ::open( temporary.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0640 ) };
+    const auto written{ descriptor >= 0 ? ::write( descriptor, data.data(), data.size() ) : -1 };
+    const auto synced{ descriptor >= 0 && ::fdatasync( descriptor ) == 0 };
+
+    ::close( descriptor );
+
+    if ( written != static_cast<ssize_t>( data.size() ) || ! synced || ::rename( temporary.c_str(), path.c_str() ) != 0 )
+    {
+        BOOST_LOG_TRIVIAL( error ) << "Failed to save the key index snapshot";
+    }
+}
+
+Blockchain::KeyIndex::Postings & Blockchain::KeyIndex::addKey( const std::string & key )
+{
+    //! Expects m_mutex to be locked by the caller, the elements of the map never move
+    auto & entry{ * m_postings.emplace( key, Postings{} ).first };
+
+    entry.second.id = m_ids.size();
+    m_ids.push_back( & entry );
+
+    return entry.second;
+}
+
+void Blockchain::KeyIndex::insert( Postings & postings,
+                                   const std::uint64_t delta )
+{
+    //! Expects m_mutex to be locked by the caller
+    appendVarint( postings.deltas, delta );
+    postings.last = m_count++;
+}
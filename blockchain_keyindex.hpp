@@ -0,0 +1,48 @@
+#pragma once
+
+#include "blockchain.hpp"
+#include <unordered_map>
+
+namespace bitchat {
+
+class Blockchain::KeyIndex : private boost::noncopyable
+{
+    struct Postings
+    {
+        std::uint64_t id;       //! the order the key first appeared in, records refer to it
+        std::uint64_t last;
+        std::string deltas;   //! varint encoded gaps between block indices
+    };
+    using PostingsMap = std::unordered_map<std::string, Postings>;
+
+public:
+    explicit KeyIndex( const std::string & path );
+    ~KeyIndex();
+
+    std::uint64_t open( const std::uint64_t limit );
+    void close();
+
+    void append( const Block & block );
+    void flush();
+
+    std::vector<std::uint64_t> find( const std::string & key ) const;
+
+private:
+    std::uint64_t load( const std::uint64_t limit,
+                        const std::uint64_t size );
+    void save();
+    Postings & addKey( const std::string & key );
+    void insert( Postings & postings,
+                 const std::uint64_t delta );
+
+private:
+    const std::string m_path;
+    int m_descriptor;
+    std::uint64_t m_count;
+    std::string m_records;
+    PostingsMap m_postings;
+    std::vector<PostingsMap::value_type *> m_ids;  //! the keys and their postings by the ids
+    mutable std::mutex m_mutex;
+};
+
+} // bitchat
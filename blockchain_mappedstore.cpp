@@ -0,0 +1,132 @@
+#include "blockchain_mappedstore.hpp"
+#include <sys/mman.h>
+#include <algorithm>
+#include <cstring>
+
+using bitchat::Blockchain;
+
+namespace
+{
+constexpr auto kMappingStep{ 64 * 1024 * 1024 }; //! 64MB
+}
+
+Blockchain::MappedStore::MappedStore( const std::string & path ) :
+    FileStore{ path },
+    m_sealed{ false },
+    m_size{ 0 },
+    m_mapping{},
+    m_mappingSize{ 0 }
+{
+}
+
+Blockchain::MappedStore::~MappedStore()
+{
+    MappedStore::close();
+}
+
+std::uint64_t Blockchain::MappedStore::open( const bool sealed )
+{
+    m_sealed = sealed;
+    const auto size{ FileStore::open( sealed ) };
+
+    map( size );
+    m_size = size;
+
+    return size;
+}
+
+void Blockchain::MappedStore::close()
+{
+    std::atomic_store( & m_mapping, std::shared_ptr<const char>{} );
+    m_mappingSize = 0;
+    m_size = 0;
+    FileStore::close();
+}
+
+void Blockchain::MappedStore::truncate( const std::uint64_t size )
+{
+    //! A mapping of the tail may run past the end of file, it is kept as is
+    FileStore::truncate( size );
+    m_size = size;
+}
+
+std::uint64_t Blockchain::MappedStore::read( const std::uint64_t offset,
+                                             const std::uint64_t size,
+                                             char * data )
+{
+    //! The size grows only once the mapping covers it
+    const std::uint64_t stored{ m_size };
+    const auto mapping{ std::atomic_load( & m_mapping ) };
+
+    if ( mapping == nullptr )
+    {
+        return FileStore::read( offset, size, data );
+    }
+
+    const auto available{ offset < stored ? std::min( size, stored - offset ) : 0 };
+
+    std::memcpy( data, mapping.get() + offset, available );
+
+    return available;
+}
+
+void Blockchain::MappedStore::write( const std::uint64_t offset,
+                                     const HeadPtr * heads,
+                                     const std::size_t count )
+{
+    const auto size{ std::max<std::uint64_t>( m_size, offset + count * getBlockSize() ) };
+
+    FileStore::write( offset, heads, count );
+
+    if ( size > m_mappingSize )
+    {
+        map( size );
+    }
+
+    m_size = size;
+}
+
+Blockchain::View Blockchain::MappedStore::view( const std::uint64_t offset,
+                                                std::uint64_t & size ) const
+{
+    const std::uint64_t stored{ m_size };
+    const auto mapping{ std::atomic_load( & m_mapping ) };
+
+    if ( mapping == nullptr || offset >= stored )
+    {
+        size = 0;
+        return View{};
+    }
+
+    size = std::min( size, stored - offset );
+
+    return View{ mapping, mapping.get() + offset };
+}
+
+void Blockchain::MappedStore::map( const std::uint64_t stored )
+{
+    //! Sealed segments are mapped exactly, the writable tail grows in large steps
+    //! and its mapping may run past the end of file, only the written part is touched.
+    //! A grown tail gets a new mapping rather than a moved one, the views handed out
+    //! keep the old one alive until they are released
+    const auto size{ m_sealed ? stored : ( stored / kMappingStep + 1 ) * kMappingStep };
+
+    if ( size == 0 )
+    {
+        return;
+    }
+
+    const auto mapping{ ::mmap( nullptr, size, PROT_READ, MAP_SHARED, getDescriptor(), 0 ) };
+
+    if ( mapping == MAP_FAILED )
+    {
+        throwLastError( "Failed to map the blockchain segment" );
+    }
+
+    const std::shared_ptr<const char> mapped{ static_cast<const char *>( mapping ), [ size ]( const char * data ) {
+        ::munmap( const_cast<char *>( data ), size );
+    } };
+
+    std::atomic_store( & m_mapping, mapped );
+    m_mappingSize = size;
+}
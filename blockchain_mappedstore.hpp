@@ -0,0 +1,38 @@
+#pragma once
+
+#include "blockchain_filestore.hpp"
+
+namespace bitchat {
+
+//! Writes through the file and reads straight from its mapping
+class Blockchain::MappedStore : public FileStore
+{
+public:
+    explicit MappedStore( const std::string & path );
+    ~MappedStore() override;
+
+    std::uint64_t open( const bool sealed ) override;
+    void close() override;
+    void truncate( const std::uint64_t size ) override;
+
+    std::uint64_t read( const std::uint64_t offset,
+                        const std::uint64_t size,
+                        char * data ) override;
+    void write( const std::uint64_t offset,
+                const HeadPtr * heads,
+                const std::size_t count ) override;
+
+    View view( const std::uint64_t offset,
+               std::uint64_t & size ) const override;
+
+private:
+    void map( const std::uint64_t stored );
+
+private:
+    bool m_sealed;
+    std::atomic<std::uint64_t> m_size;
+    std::shared_ptr<const char> m_mapping;  //! swapped atomically, the reads take no lock
+    std::size_t m_mappingSize;
+};
+
+} // bitchat
@@ -0,0 +1,110 @@
+#include "blockchain_memorystore.hpp"
+#include <algorithm>
+#include <cstring>
+
+using bitchat::Blockchain;
+
+namespace
+{
+constexpr auto kChunkBlocks{ 64 * 1024 };
+}
+
+Blockchain::MemoryStore::MemoryStore() :
+    m_chunks{ std::make_shared<Chunks>() },
+    m_size{ 0 }
+{
+}
+
+std::uint64_t Blockchain::MemoryStore::open( const bool )
+{
+    return m_size;
+}
+
+void Blockchain::MemoryStore::close()
+{
+    std::atomic_store( & m_chunks, std::shared_ptr<const Chunks>{ std::make_shared<Chunks>() } );
+    m_size = 0;
+}
+
+void Blockchain::MemoryStore::sync()
+{
+}
+
+void Blockchain::MemoryStore::truncate( const std::uint64_t size )
+{
+    auto chunks{ std::make_shared<Chunks>( * m_chunks ) };
+
+    m_size = std::min<std::uint64_t>( m_size, size );
+    chunks->resize( ( m_size + getChunkSize() - 1 ) / getChunkSize() );
+    std::atomic_store( & m_chunks, std::shared_ptr<const Chunks>{ chunks } );
+}
+
+std::uint64_t Blockchain::MemoryStore::read( const std::uint64_t offset,
+                                             const std::uint64_t size,
+                                             char * data )
+{
+    //! The size grows only once the chunks hold it
+    const std::uint64_t stored{ m_size };
+    const auto chunks{ std::atomic_load( & m_chunks ) };
+    const auto available{ offset < stored ? std::min( size, stored - offset ) : 0 };
+
+    for ( auto done{ 0ull }; done < available; )
+    {
+        const auto position{ offset + done };
+        const auto length{ std::min( available - done, getChunkSize() - position % getChunkSize() ) };
+
+        std::memcpy( data + done, ( * chunks )[ position / getChunkSize() ].get() + position % getChunkSize(), length );
+        done += length;
+    }
+
+    return available;
+}
+
+void Blockchain::MemoryStore::write( const std::uint64_t offset,
+                                     const HeadPtr * heads,
+                                     const std::size_t count )
+{
+    //! A chunk holds whole blocks, so a block is never split between two
+    BOOST_ASSERT( offset == m_size );
+    auto size{ offset };
+
+    for ( auto i{ 0ull }; i < count; ++i, size += getBlockSize() )
+    {
+        if ( size / getChunkSize() == m_chunks->size() )
+        {
+            auto chunks{ std::make_shared<Chunks>( * m_chunks ) };
+
+            chunks->emplace_back( new char[ getChunkSize() ], std::default_delete<char[]>() );
+            std::atomic_store( & m_chunks, std::shared_ptr<const Chunks>{ chunks } );
+        }
+
+        std::memcpy( m_chunks->back().get() + size % getChunkSize(), heads[ i ]->block.getRawPointer(), getBlockSize() );
+    }
+
+    m_size = size;
+}
+
+Blockchain::View Blockchain::MemoryStore::view( const std::uint64_t offset,
+                                                std::uint64_t & size ) const
+{
+    const std::uint64_t stored{ m_size };
+    const auto chunks{ std::atomic_load( & m_chunks ) };
+
+    if ( offset >= stored )
+    {
+        size = 0;
+        return View{};
+    }
+
+    //! A view doesn't run over into the next chunk
+    size = std::min( { size, stored - offset, getChunkSize() - offset % getChunkSize() } );
+
+    const auto & chunk{ ( * chunks )[ offset / getChunkSize() ] };
+
+    return View{ chunk, chunk.get() + offset % getChunkSize() };
+}
+
+std::uint64_t Blockchain::MemoryStore::getChunkSize()
+{
+    return kChunkBlocks * getBlockSize();
+}
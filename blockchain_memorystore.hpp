@@ -0,0 +1,39 @@
+#pragma once
+
+#include "blockchain_store.hpp"
+
+namespace bitchat {
+
+//! Keeps the blocks in fixed chunks of memory which never move, so the views
+//! stay valid while the store grows, nothing outlives the process
+class Blockchain::MemoryStore : public Store
+{
+public:
+    MemoryStore();
+
+    std::uint64_t open( const bool sealed ) override;
+    void close() override;
+    void sync() override;
+    void truncate( const std::uint64_t size ) override;
+
+    std::uint64_t read( const std::uint64_t offset,
+                        const std::uint64_t size,
+                        char * data ) override;
+    void write( const std::uint64_t offset,
+                const HeadPtr * heads,
+                const std::size_t count ) override;
+
+    View view( const std::uint64_t offset,
+               std::uint64_t & size ) const override;
+
+private:
+    using Chunks = std::vector<std::shared_ptr<char>>;
+
+    static std::uint64_t getChunkSize();
+
+private:
+    std::shared_ptr<const Chunks> m_chunks;     //! replaced when a chunk is added, the reads take no lock
+    std::atomic<std::uint64_t> m_size;
+};
+
+} // bitchat
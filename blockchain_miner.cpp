@@ -0,0 +1,147 @@
+#include "blockchain_miner.hpp"
+#include "hasher.hpp"
+#include <boost/log/trivial.hpp>
+#include <cstring>
+#include <thread>
+#include <chrono>
+#include <limits>
+
+using bitchat::Blockchain;
+
+namespace
+{
+constexpr auto kNonceBatch{ 1024 }; //! nonces tried between the cancellation checks
+}
+
+Blockchain::Miner::Miner( const unsigned threads ) :
+    m_threads{ std::max( threads, 1u ) },
+    m_cancelled{ 0 },
+    m_hashRate{ 0 }
+{
+}
+
+bool Blockchain::Miner::mine( Block & block )
+{
+    //! Only the nonce changes between the attempts, so the chunks before it are hashed once
+    //! and every attempt compresses just the rest of the block
+    const auto midstate{ Hasher::absorb( block.getRawPointer(), Block::kNonceOffset ) };
+    const auto restSize{ Block::getSize() - midstate.size };
+    const auto nonceOffset{ Block::kNonceOffset - midstate.size };
+    const auto span{ std::numeric_limits<std::uint64_t>::max() / m_threads };
+    const auto start{ std::chrono::steady_clock::now() };
+    std::atomic<bool> found{ false };
+    std::atomic<std::uint64_t> hashes{ 0 };
+    std::uint64_t nonce{ 0 };
+    std::vector<std::thread> pool{};
+    const auto search{ [ & ]( const unsigned i ) {
+        const auto first{ span * i };
+        std::vector<char> rests( restSize * kNonceBatch );
+        std::vector<Block::Sha256> digests( kNonceBatch );
+        auto tried{ 0ull };
+
+        for ( auto j{ 0u }; j < kNonceBatch; ++j )
+        {
+            std::memcpy( rests.data() + j * restSize, block.getRawPointer() + midstate.size, restSize );
+        }
+
+        for ( auto base{ first }; base - first < span && ! found && ! isCancelled( block.index ); base += kNonceBatch )
+        {
+            for ( auto j{ 0ull }; j < kNonceBatch; ++j )
+            {
+                const auto candidate{ base + j };
+                std::memcpy( rests.data() + j * restSize + nonceOffset, & candidate, sizeof( candidate ) );
+            }
+
+            Hasher::hash( midstate, rests.data(), restSize, restSize, kNonceBatch, digests.front().data() );
+            tried += kNonceBatch;
+
+            for ( auto j{ 0u }; j < kNonceBatch; ++j )
+            {
+                if ( isSolved( digests[ j ], block.difficult ) && ! found.exchange( true ) )
+                {
+                    nonce = base + j;
+                    break;
+                }
+            }
+        }
+
+        hashes += tried;
+    } };
+
+    //! The calling thread searches the first span itself
+    for ( auto i{ 1u }; i < m_threads; ++i )
+    {
+        pool.emplace_back( search, i );
+    }
+
+    search( 0 );
+
+    for ( auto & thread : pool )
+    {
+        thread.join();
+    }
+
+    const std::chrono::duration<double> elapsed{ std::chrono::steady_clock::now() - start };
+
+    m_hashRate = static_cast<std::uint64_t>( hashes / std::max( elapsed.count(), 1e-9 ) );
+
+    if ( ! found )
+    {
+        BOOST_LOG_TRIVIAL( info ) << "Mining of block " << block.index << " cancelled after " << hashes << " hashes";
+        return false;
+    }
+
+    block.nonce = nonce;
+
+    BOOST_LOG_TRIVIAL( info ) << "Mined block " << block.index << " in " << elapsed.count() << "s with "
+                              << m_threads << " threads (" << m_hashRate << " hashes/s)";
+
+    return true;
+}
+
+void Blockchain::Miner::cancel( const std::uint64_t index )
+{
+    auto cancelled{ m_cancelled.load() };
+
+    while ( cancelled < index && ! m_cancelled.compare_exchange_weak( cancelled, index ) );
+}
+
+void Blockchain::Miner::reset()
+{
+    m_cancelled = 0;
+}
+
+std::uint64_t Blockchain::Miner::getHashRate() const
+{
+    return m_hashRate;
+}
+
+bool Blockchain::Miner::isSolved( const Block::Sha256 & hash,
+                                  const std::uint8_t difficult )
+{
+    auto bits{ static_cast<unsigned>( difficult ) };
+
+    for ( auto byte : hash )
+    {
+        if ( bits == 0 )
+        {
+            break;
+        }
+
+        const auto mask{ static_cast<unsigned char>( 0xff << ( bits < 8 ? 8 - bits : 0 ) ) };
+
+        if ( ( static_cast<unsigned char>( byte ) & mask ) != 0 )
+        {
+            return false;
+        }
+
+        bits -= std::min( bits, 8u );
+    }
+
+    return bits == 0;
+}
+
+bool Blockchain::Miner::isCancelled( const std::uint64_t index ) const
+{
+    return index <= m_cancelled;
+}
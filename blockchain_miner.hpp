@@ -0,0 +1,34 @@
+#pragma once
+
+#include "blockchain_block.hpp"
+
+namespace bitchat {
+
+class Blockchain::Miner : private boost::noncopyable
+{
+public:
+    explicit Miner( const unsigned threads );
+
+    //! Searches the nonce space for a hash with block.difficult leading zero bits,
+    //! returns false when the search for this index was cancelled
+    bool mine( Block & block );
+
+    //! Aborts the searches for the blocks up to the given index
+    void cancel( const std::uint64_t index );
+    void reset();
+
+    std::uint64_t getHashRate() const;
+
+    static bool isSolved( const Block::Sha256 & hash,
+                          const std::uint8_t difficult );
+
+private:
+    bool isCancelled( const std::uint64_t index ) const;
+
+private:
+    const unsigned m_threads;
+    std::atomic<std::uint64_t> m_cancelled;
+    std::atomic<std::uint64_t> m_hashRate;
+};
+
+} // bitchat
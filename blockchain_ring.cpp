@@ -0,0 +1,371 @@
+#include "blockchain_ring.hpp"
+#include <boost/asio/read.hpp>
+#include <boost/log/trivial.hpp>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+using bitchat::Blockchain;
+
+namespace
+{
+constexpr auto kBuffers{ 16u };
+constexpr auto kBufferSize{ 256 * 1024 }; //! 256KB
+
+template<typename T>
+T * getField( void * ring,
+              const std::uint32_t offset )
+{
+    return reinterpret_cast<T *>( static_cast<char *>( ring ) + offset );
+}
+}
+
+Blockchain::Ring::Ring( boost::asio::io_service & ios ) :
+    m_descriptor{ -1 },
+    m_event{ -1 },
+    m_signals{ 0 },
+    m_notifier{ ios },
+    m_rings{ MAP_FAILED },
+    m_ringsSize{ 0 },
+    m_completionRings{ MAP_FAILED },
+    m_completionRingsSize{ 0 },
+    m_entries{ nullptr },
+    m_entriesSize{ 0 },
+    m_submissionTail{ nullptr },
+    m_submissionMask{ nullptr },
+    m_submissionArray{ nullptr },
+    m_completionHead{ nullptr },
+    m_completionTail{ nullptr },
+    m_completionMask{ nullptr },
+    m_completions{ nullptr },
+    m_buffers{ nullptr },
+    m_handlers( kBuffers ),
+    m_inFlight{ 0 }
+{
+}
+
+Blockchain::Ring::~Ring()
+{
+    close();
+}
+
+bool Blockchain::Ring::open()
+{
+    //! liburing isn't required, the ring is set up with the raw system calls
+    io_uring_params params{};
+    std::vector<iovec> vectors{};
+
+    m_descriptor = static_cast<int>( ::syscall( __NR_io_uring_setup, kBuffers, & params ) );
+
+    if ( m_descriptor < 0 )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "io_uring is not available: " << std::strerror( errno );
+        return false;
+    }
+
+    m_ringsSize = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+    m_completionRingsSize = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+    m_entriesSize = params.sq_entries * sizeof( io_uring_sqe );
+
+    if ( ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0 )
+    {
+        m_ringsSize = std::max( m_ringsSize, m_completionRingsSize );
+    }
+
+    m_rings = ::mmap( nullptr, m_ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_descriptor, IORING_OFF_SQ_RING );
+    m_completionRings = ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0 || m_rings == MAP_FAILED ? m_rings :
+                        ::mmap( nullptr, m_completionRingsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                m_descriptor, IORING_OFF_CQ_RING );
+    const auto entries{ ::mmap( nullptr, m_entriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                m_descriptor, IORING_OFF_SQES ) };
+    const auto buffers{ ::mmap( nullptr, kBuffers * kBufferSize, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 ) };
+
+    m_entries = entries == MAP_FAILED ? nullptr : static_cast<io_uring_sqe *>( entries );
+    m_buffers = buffers == MAP_FAILED ? nullptr : static_cast<char *>( buffers );
+
+    for ( auto i{ 0u }; i < kBuffers && m_buffers != nullptr; ++i )
+    {
+        vectors.push_back( iovec{ getBuffer( i ), kBufferSize } );
+    }
+
+    m_event = ::eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+
+    if ( m_rings == MAP_FAILED || m_completionRings == MAP_FAILED || m_entries == nullptr || m_buffers == nullptr ||
+         m_event < 0 ||
+         ::syscall( __NR_io_uring_register, m_descriptor, IORING_REGISTER_BUFFERS, vectors.data(), kBuffers ) != 0 ||
+         ::syscall( __NR_io_uring_register, m_descriptor, IORING_REGISTER_EVENTFD, & m_event, 1 ) != 0 )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Failed to set up io_uring: " << std::strerror( errno );
+        close();
+        return false;
+    }
+
+    m_submissionTail = getField<unsigned>( m_rings, params.sq_off.tail );
+    m_submissionMask = getField<unsigned>( m_rings, params.sq_off.ring_mask );
+    m_submissionArray = getField<unsigned>( m_rings, params.sq_off.array );
+    m_completionHead = getField<unsigned>( m_completionRings, params.cq_off.head );
+    m_completionTail = getField<unsigned>( m_completionRings, params.cq_off.tail );
+    m_completionMask = getField<unsigned>( m_completionRings, params.cq_off.ring_mask );
+    m_completions = getField<io_uring_cqe>( m_completionRings, params.cq_off.cqes );
+
+    m_free.clear();
+
+    for ( auto i{ kBuffers }; i > 0; --i )
+    {
+        m_free.push_back( i - 1 );
+    }
+
+    m_notifier.assign( m_event );
+    wait();
+
+    BOOST_LOG_TRIVIAL( debug ) << "Opened io_uring with " << kBuffers << " registered buffers";
+    return true;
+}
+
+void Blockchain::Ring::close()
+{
+    if ( isOpen() )
+    {
+        drain();
+    }
+
+    if ( m_notifier.is_open() )
+    {
+        //! The eventfd is owned by the notifier from now on
+        m_notifier.close();
+        m_event = -1;
+    }
+
+    if ( m_event >= 0 )
+    {
+        ::close( m_event );
+        m_event = -1;
+    }
+
+    if ( m_buffers != nullptr )
+    {
+        ::munmap( m_buffers, kBuffers * kBufferSize );
+        m_buffers = nullptr;
+    }
+
+    if ( m_entries != nullptr )
+    {
+        ::munmap( m_entries, m_entriesSize );
+        m_entries = nullptr;
+    }
+
+    if ( m_completionRings != MAP_FAILED && m_completionRings != m_rings )
+    {
+        ::munmap( m_completionRings, m_completionRingsSize );
+    }
+
+    if ( m_rings != MAP_FAILED )
+    {
+        ::munmap( m_rings, m_ringsSize );
+    }
+
+    m_rings = MAP_FAILED;
+    m_completionRings = MAP_FAILED;
+
+    if ( m_descriptor >= 0 )
+    {
+        ::close( m_descriptor );
+        m_descriptor = -1;
+    }
+
+    std::lock_guard<std::mutex> lock{ m_mutex };
+    m_free.clear();
+}
+
+bool Blockchain::Ring::isOpen() const
+{
+    return m_descriptor >= 0 && m_notifier.is_open();
+}
+
+bool Blockchain::Ring::read( const int descriptor,
+                             const std::uint64_t offset,
+                             const std::size_t size,
+                             const Handler & handler )
+{
+    return submit( IORING_OP_READ_FIXED, descriptor, offset, size, Filler{}, handler );
+}
+
+bool Blockchain::Ring::write( const int descriptor,
+                              const std::uint64_t offset,
+                              const std::size_t size,
+                              const Filler & fill,
+                              const Handler & handler )
+{
+    return submit( IORING_OP_WRITE_FIXED, descriptor, offset, size, fill, handler );
+}
+
+bool Blockchain::Ring::submit( const std::uint8_t opcode,
+                               const int descriptor,
+                               const std::uint64_t offset,
+                               const std::size_t size,
+                               const Filler & fill,
+                               const Handler & handler )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    if ( ! isOpen() || m_free.empty() || size > kBufferSize )
+    {
+        return false;
+    }
+
+    const auto buffer{ m_free.back() };
+    const auto tail{ * m_submissionTail };
+    const auto index{ tail & * m_submissionMask };
+    auto & entry{ m_entries[ index ] };
+
+    m_free.pop_back();
+    m_handlers[ buffer ] = handler;
+
+    if ( fill )
+    {
+        fill( getBuffer( buffer ) );
+    }
+
+    std::memset( & entry, 0, sizeof( entry ) );
+    entry.opcode = opcode;
+    entry.fd = descriptor;
+    entry.off = offset;
+    entry.addr = reinterpret_cast<std::uint64_t>( getBuffer( buffer ) );
+    entry.len = static_cast<std::uint32_t>( size );
+    entry.buf_index = static_cast<std::uint16_t>( buffer );
+    entry.user_data = buffer;
+    m_submissionArray[ index ] = index;
+
+    //! The kernel must see the entry before it sees the new tail
+    __atomic_store_n( m_submissionTail, tail + 1, __ATOMIC_RELEASE );
+    ++m_inFlight;
+
+    enter( 1, 0 );
+
+    return true;
+}
+
+void Blockchain::Ring::wait()
+{
+    m_notifier.async_read_some( boost::asio::buffer( & m_signals, sizeof( m_signals ) ),
+                                [ this ]( const auto & error, const auto ) {
+        if ( ! error )
+        {
+            reap();
+            wait();
+        }
+    } );
+}
+
+void Blockchain::Ring::reap()
+{
+    std::lock_guard<std::mutex> reapLock{ m_reapMutex };
+
+    complete();
+}
+
+void Blockchain::Ring::drain()
+{
+    //! Only one thread reaps at a time, so the requests which are still in flight
+    //! while the lock is held are bound to complete into the ring
+    std::lock_guard<std::mutex> reapLock{ m_reapMutex };
+
+    for ( ;; )
+    {
+        do
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+
+            if ( m_inFlight == 0 )
+            {
+                return;
+            }
+        } while( false );
+
+        enter( 0, 1 );
+        complete();
+    }
+}
+
+void Blockchain::Ring::complete()
+{
+    //! Expects m_reapMutex to be locked by the caller
+    Completed completed{};
+    auto head{ * m_completionHead };
+    const auto tail{ __atomic_load_n( m_completionTail, __ATOMIC_ACQUIRE ) };
+
+    for ( ; head != tail; ++head )
+    {
+        const auto & completion{ m_completions[ head & * m_completionMask ] };
+
+        completed.emplace_back( static_cast<std::size_t>( completion.user_data ), completion.res );
+    }
+
+    __atomic_store_n( m_completionHead, head, __ATOMIC_RELEASE );
+
+    for ( auto it{ completed.begin() }; it != completed.end(); ++it )
+    {
+        Handler handler{};
+
+        do
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            handler.swap( m_handlers[ it->first ] );
+        } while( false );
+
+        try
+        {
+            if ( handler )
+            {
+                handler( it->second, getBuffer( it->first ) );
+            }
+        }
+        catch ( ... )
+        {
+            //! The requests reaped along with the failed one are dropped
+            release( it, completed.end() );
+            throw;
+        }
+
+        release( it, it + 1 );
+    }
+}
+
+void Blockchain::Ring::release( Completed::const_iterator begin,
+                                Completed::const_iterator end )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    for ( ; begin != end; ++begin )
+    {
+        m_handlers[ begin->first ] = Handler{};
+        m_free.push_back( begin->first );
+        --m_inFlight;
+    }
+}
+
+void Blockchain::Ring::enter( const unsigned submit,
+                              const unsigned complete )
+{
+    const auto flags{ complete > 0 ? IORING_ENTER_GETEVENTS : 0u };
+
+    while ( ::syscall( __NR_io_uring_enter, m_descriptor, submit, complete, flags, nullptr, 0 ) < 0 )
+    {
+        if ( errno != EINTR )
+        {
+            throwLastError( "Failed to enter io_uring" );
+        }
+    }
+}
+
+char * Blockchain::Ring::getBuffer( const std::size_t buffer ) const
+{
+    return m_buffers + buffer * kBufferSize;
+}
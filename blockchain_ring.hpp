@@ -0,0 +1,85 @@
+#pragma once
+
+#include "blockchain.hpp"
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <functional>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace bitchat {
+
+//! Submits reads and writes to io_uring from a set of registered buffers,
+//! the completions are reaped on the io_service as the ring signals its eventfd
+class Blockchain::Ring : private boost::noncopyable
+{
+public:
+    using Filler = std::function<void ( char * buffer )>;
+    using Handler = std::function<void ( const int result,
+                                         const char * data )>;
+
+    explicit Ring( boost::asio::io_service & ios );
+    ~Ring();
+
+    bool open();
+    void close();
+    bool isOpen() const;
+
+    //! Both return false when no registered buffer is free or large enough,
+    //! the caller is expected to fall back to the synchronous calls then
+    bool read( const int descriptor,
+               const std::uint64_t offset,
+               const std::size_t size,
+               const Handler & handler );
+    bool write( const int descriptor,
+                const std::uint64_t offset,
+                const std::size_t size,
+                const Filler & fill,
+                const Handler & handler );
+
+private:
+    using Completed = std::vector<std::pair<std::size_t, int>>;
+
+    bool submit( const std::uint8_t opcode,
+                 const int descriptor,
+                 const std::uint64_t offset,
+                 const std::size_t size,
+                 const Filler & fill,
+                 const Handler & handler );
+    void wait();
+    void reap();
+    void drain();
+    void complete();
+    void release( Completed::const_iterator begin,
+                  Completed::const_iterator end );
+    void enter( const unsigned submit,
+                const unsigned complete );
+    char * getBuffer( const std::size_t buffer ) const;
+
+private:
+    int m_descriptor;
+    int m_event;
+    std::uint64_t m_signals;
+    boost::asio::posix::stream_descriptor m_notifier;
+    void * m_rings;
+    std::size_t m_ringsSize;
+    void * m_completionRings;
+    std::size_t m_completionRingsSize;
+    io_uring_sqe * m_entries;
+    std::size_t m_entriesSize;
+    unsigned * m_submissionTail;
+    unsigned * m_submissionMask;
+    unsigned * m_submissionArray;
+    unsigned * m_completionHead;
+    unsigned * m_completionTail;
+    unsigned * m_completionMask;
+    io_uring_cqe * m_completions;
+    char * m_buffers;
+    std::vector<std::size_t> m_free;
+    std::vector<Handler> m_handlers;
+    std::size_t m_inFlight;
+    std::mutex m_mutex;
+    std::mutex m_reapMutex;
+};
+
+} // bitchat
@@ -0,0 +1,251 @@
+#include "blockchain_segment.hpp"
+#include "blockchain_archive.hpp"
+#include "blockchain_store.hpp"
+#include <boost/filesystem/operations.hpp>
+#include <boost/log/trivial.hpp>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+using bitchat::Blockchain;
+
+Blockchain::Segment::Segment( const std::string & path,
+                              const std::uint64_t first,
+                              const Storage storage ) :
+    m_path{ path },
+    m_first{ first },
+    m_storage{ storage },
+    m_sealed{ false },
+    m_count{ 0 },
+    m_store{ Store::create( path, storage ) }
+{
+}
+
+Blockchain::Segment::~Segment()
+{
+    close();
+}
+
+std::uint64_t Blockchain::Segment::open( const bool sealed )
+{
+    m_sealed = sealed;
+
+    //! An archive written earlier is read in place of the raw blocks
+    if ( sealed && m_storage != Storage::kMemory && boost::filesystem::exists( getArchivePath() ) )
+    {
+        std::make_unique<Archive>( getArchivePath() ).swap( m_archived );
+        m_count = m_archived->open();
+        return m_count;
+    }
+
+    const auto size{ m_store->open( sealed ) };
+
+    m_count = size / getBlockSize();
+
+    if ( ! sealed && m_count * getBlockSize() != size )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Dropped a partially written block at the end of " << m_path;
+        truncate( m_count );
+    }
+
+    return m_count;
+}
+
+void Blockchain::Segment::close()
+{
+    m_archived.reset();
+    m_store->close();
+    m_count = 0;
+}
+
+void Blockchain::Segment::seal()
+{
+    //! The store stays open as it is, the reads going on don't notice, it is opened
+    //! read-only the next time the chain opens
+    BOOST_ASSERT( ! m_sealed );
+
+    sync();
+    m_sealed = true;
+    BOOST_LOG_TRIVIAL( info ) << "Sealed the blockchain segment " << m_path;
+}
+
+void Blockchain::Segment::sync()
+{
+    if ( ! m_sealed )
+    {
+        m_store->sync();
+    }
+}
+
+void Blockchain::Segment::truncate( const std::uint64_t count )
+{
+    BOOST_ASSERT( ! m_sealed && count <= m_count );
+
+    m_store->truncate( count * getBlockSize() );
+    m_count = count;
+}
+
+void Blockchain::Segment::archive() const
+{
+    //! The file of a sealed segment doesn't change, it is compressed without the chain mutex
+    BOOST_ASSERT( m_sealed && m_storage != Storage::kMemory );
+
+    Archive archived{ getArchivePath() };
+
+    Archive::create( m_path, getArchivePath() );
+
+    if ( archived.open() != m_count )
+    {
+        archived.close();
+        ::remove( getArchivePath().c_str() );
+        throw std::runtime_error( "The blockchain archive " + getArchivePath() + " is incomplete" );
+    }
+}
+
+std::uint64_t Blockchain::Segment::getFirst() const
+{
+    return m_first;
+}
+
+std::uint64_t Blockchain::Segment::getCount() const
+{
+    return m_count;
+}
+
+bool Blockchain::Segment::isSealed() const
+{
+    return m_sealed;
+}
+
+bool Blockchain::Segment::isArchived() const
+{
+    return m_archived != nullptr;
+}
+
+bool Blockchain::Segment::read( const std::uint64_t index,
+                                Block & block )
+{
+    return read( index, 1, & block ) == 1;
+}
+
+std::uint64_t Blockchain::Segment::read( const std::uint64_t index,
+                                         const std::uint64_t count,
+                                         Block * blocks )
+{
+    //! Returns the number of blocks read
+    const std::uint64_t stored{ m_count };
+    const auto available{ index < stored ? std::min( count, stored - index ) : 0 };
+    std::uint64_t done{ 0 };
+
+    if ( m_archived )
+    {
+        for ( ; done < available && m_archived->read( index + done, blocks[ done ] ); ++done );
+        return done;
+    }
+
+    done = m_store->read( index * getBlockSize(), available * getBlockSize(), reinterpret_cast<char *>( blocks ) );
+
+    return done / getBlockSize();
+}
+
+void Blockchain::Segment::append( const HeadPtr * heads,
+                                  const std::size_t count )
+{
+    BOOST_ASSERT( ! m_sealed );
+
+    m_store->write( m_count * getBlockSize(), heads, count );
+    m_count += count;
+}
+
+Blockchain::View Blockchain::Segment::view( const std::uint64_t index,
+                                            std::uint64_t & count ) const
+{
+    const std::uint64_t stored{ m_count };
+    auto size{ std::min( count, stored > index ? stored - index : 0 ) * getBlockSize() };
+
+    if ( m_archived || size == 0 )
+    {
+        count = 0;
+        return View{};
+    }
+
+    const auto view{ m_store->view( index * getBlockSize(), size ) };
+
+    count = size / getBlockSize();
+
+    return count > 0 ? view : View{};
+}
+
+bool Blockchain::Segment::read( Ring & ring,
+                                const std::uint64_t index,
+                                const std::uint64_t count,
+                                const Ring::Handler & handler )
+{
+    const auto descriptor{ m_store->getDescriptor() };
+
+    if ( m_archived || descriptor < 0 || index + count > m_count )
+    {
+        return false;
+    }
+
+    return ring.read( descriptor, index * getBlockSize(), count * getBlockSize(), handler );
+}
+
+bool Blockchain::Segment::append( Ring & ring,
+                                  const HeadPtr * heads,
+                                  const std::size_t count,
+                                  const Ring::Handler & handler )
+{
+    //! The blocks are reserved at once, they are only counted by the blockchain
+    //! when the write completes
+    BOOST_ASSERT( ! m_sealed );
+    const auto descriptor{ m_store->getDescriptor() };
+    const auto offset{ m_count * getBlockSize() };
+    const auto size{ count * getBlockSize() };
+    const auto fill{ [ heads, count ]( char * buffer ) {
+        for ( auto i{ 0ull }; i < count; ++i )
+        {
+            std::memcpy( buffer + i * getBlockSize(), heads[ i ]->block.getRawPointer(), getBlockSize() );
+        }
+    } };
+    const auto complete{ [ descriptor, offset, size, handler ]( const int result, const char * data ) {
+        auto written{ static_cast<std::size_t>( std::max( result, 0 ) ) };
+
+        if ( result < 0 )
+        {
+            errno = -result;
+            throwLastError( "Failed to write blocks" );
+        }
+
+        for ( ; written < size; )
+        {
+            const auto rest{ ::pwrite64( descriptor, data + written, size - written,
+                                         static_cast<std::int64_t>( offset + written ) ) };
+
+            if ( rest < 0 )
+            {
+                throwLastError( "Failed to write blocks" );
+            }
+
+            written += static_cast<std::size_t>( rest );
+        }
+
+        handler( static_cast<int>( size ), data );
+    } };
+
+    //! Only the plain file store is written behind its back
+    if ( m_storage != Storage::kRing || descriptor < 0 || ! ring.write( descriptor, offset, size, fill, complete ) )
+    {
+        return false;
+    }
+
+    m_count += count;
+
+    return true;
+}
+
+std::string Blockchain::Segment::getArchivePath() const
+{
+    return m_path + ".z";
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "blockchain_block.hpp"
+#include "blockchain_ring.hpp"
+
+namespace bitchat {
+
+class Blockchain::Segment : private boost::noncopyable
+{
+public:
+    explicit Segment( const std::string & path,
+                      const std::uint64_t first,
+                      const Storage storage );
+    ~Segment();
+
+    std::uint64_t open( const bool sealed );
+    void close();
+    void seal();
+    void sync();
+    void truncate( const std::uint64_t count );
+
+    //! Compresses the blocks of a sealed segment beside its file, a segment opened
+    //! sealed afterwards reads the archive
+    void archive() const;
+
+    std::uint64_t getFirst() const;
+    std::uint64_t getCount() const;
+    bool isSealed() const;
+    bool isArchived() const;
+
+    bool read( const std::uint64_t index,
+               Block & block );
+    std::uint64_t read( const std::uint64_t index,
+                        const std::uint64_t count,
+                        Block * blocks );
+
+    //! A view of up to count blocks in the store, empty when it doesn't keep them
+    //! in memory. The count shrinks to how many blocks the view holds
+    View view( const std::uint64_t index,
+               std::uint64_t & count ) const;
+    void append( const HeadPtr * heads,
+                 const std::size_t count );
+
+    //! Submit the range to the ring, false means it has to be done synchronously
+    bool read( Ring & ring,
+               const std::uint64_t index,
+               const std::uint64_t count,
+               const Ring::Handler & handler );
+    bool append( Ring & ring,
+                 const HeadPtr * heads,
+                 const std::size_t count,
+                 const Ring::Handler & handler );
+
+private:
+    std::string getArchivePath() const;
+
+private:
+    const std::string m_path;
+    const std::uint64_t m_first;
+    const Storage m_storage;
+    bool m_sealed;
+    std::atomic<std::uint64_t> m_count;     //! read along with the appends, the chain bounds the reads
+    std::unique_ptr<Store> m_store;
+    std::unique_ptr<Archive> m_archived;
+};
+
+} // bitchat
@@ -0,0 +1,41 @@
+#include "blockchain_store.hpp"
+#include "blockchain_filestore.hpp"
+#include "blockchain_mappedstore.hpp"
+#include "blockchain_memorystore.hpp"
+
+using bitchat::Blockchain;
+
+std::unique_ptr<Blockchain::Store> Blockchain::Store::create( const std::string & path,
+                                                              const Storage storage )
+{
+    switch ( storage )
+    {
+    case Storage::kMapped:
+        return std::make_unique<MappedStore>( path );
+
+    case Storage::kMemory:
+        return std::make_unique<MemoryStore>();
+
+    case Storage::kStream:
+    case Storage::kRing:
+        break;
+    }
+
+    return std::make_unique<FileStore>( path );
+}
+
+Blockchain::Store::~Store()
+{
+}
+
+Blockchain::View Blockchain::Store::view( const std::uint64_t,
+                                          std::uint64_t & size ) const
+{
+    size = 0;
+    return View{};
+}
+
+int Blockchain::Store::getDescriptor() const
+{
+    return -1;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "blockchain_block.hpp"
+
+namespace bitchat {
+
+//! Keeps the raw blocks of a segment, the segment counts them and decides
+//! where they go, the store only moves the bytes
+class Blockchain::Store : private boost::noncopyable
+{
+public:
+    static std::unique_ptr<Store> create( const std::string & path,
+                                          const Storage storage );
+
+    virtual ~Store();
+
+    //! Returns the size of the stored blocks in bytes
+    virtual std::uint64_t open( const bool sealed ) = 0;
+    virtual void close() = 0;
+    virtual void sync() = 0;
+    virtual void truncate( const std::uint64_t size ) = 0;
+
+    //! Returns the number of bytes read
+    virtual std::uint64_t read( const std::uint64_t offset,
+                                const std::uint64_t size,
+                                char * data ) = 0;
+    virtual void write( const std::uint64_t offset,
+                        const HeadPtr * heads,
+                        const std::size_t count ) = 0;
+
+    //! The bytes at the offset shared with the store, empty when they aren't in memory.
+    //! The size shrinks to how many of the bytes asked for lie in one piece
+    virtual View view( const std::uint64_t offset,
+                       std::uint64_t & size ) const;
+
+    //! The file to submit to the ring, negative when there is none
+    virtual int getDescriptor() const;
+};
+
+} // bitchat
@@ -0,0 +1,101 @@
+#include "blockchain_timeindex.hpp"
+#include "blockchain_block.hpp"
+#include <algorithm>
+
+using bitchat::Blockchain;
+
+Blockchain::TimeIndex::TimeIndex() :
+    m_count{ 0 }
+{
+}
+
+void Blockchain::TimeIndex::reset()
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+
+    m_count = 0;
+    m_buckets.clear();
+}
+
+void Blockchain::TimeIndex::append( const Block & block )
+{
+    std::unique_lock<std::mutex> lock{ m_mutex, std::try_to_lock };
+
+    if ( lock.owns_lock() && block.index == m_count )
+    {
+        extend( block.timestamp );
+    }
+}
+
+std::vector<std::uint64_t> Blockchain::TimeIndex::find( const std::int64_t from,
+                                                        const std::int64_t to,
+                                                        const std::uint64_t count,
+                                                        const Loader & load )
+{
+    std::lock_guard<std::mutex> lock{ m_mutex };
+    std::vector<std::uint64_t> result{};
+    std::vector<Block> blocks( kBucketSize );
+
+    //! Only the blocks the commits didn't index are loaded, a bucket at a time
+    while ( m_count < count )
+    {
+        const auto loaded{ load( m_count, std::min<std::uint64_t>( count - m_count, kBucketSize - m_count % kBucketSize ),
+                                 blocks.data() ) };
+
+        if ( loaded == 0 )
+        {
+            break;
+        }
+
+        for ( auto i{ 0ull }; i < loaded; ++i )
+        {
+            extend( blocks[ i ].timestamp );
+        }
+    }
+
+    //! Peers may send timestamps out of order, so only the running maximum is
+    //! monotonic: skip the buckets which are entirely before the range with a
+    //! binary search and check the bounds of every bucket after it
+    auto bucket{ std::partition_point( m_buckets.begin(), m_buckets.end(), [ from ]( const auto & b ) {
+        return b.ceiling < from;
+    } ) };
+
+    for ( ; bucket != m_buckets.end(); ++bucket )
+    {
+        if ( bucket->minimum <= to && bucket->maximum >= from )
+        {
+            const auto begin{ static_cast<std::uint64_t>( bucket - m_buckets.begin() ) * kBucketSize };
+            const auto loaded{ load( begin, std::min<std::uint64_t>( kBucketSize, m_count - begin ), blocks.data() ) };
+
+            for ( auto i{ 0ull }; i < loaded; ++i )
+            {
+                if ( blocks[ i ].timestamp >= from && blocks[ i ].timestamp <= to )
+                {
+                    result.push_back( begin + i );
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+void Blockchain::TimeIndex::extend( const std::int64_t timestamp )
+{
+    //! Expects m_mutex to be locked by the caller
+    if ( m_count % kBucketSize == 0 )
+    {
+        const auto ceiling{ m_buckets.empty() ? timestamp : std::max( m_buckets.back().ceiling, timestamp ) };
+        m_buckets.push_back( Bucket{ timestamp, timestamp, ceiling } );
+    }
+    else
+    {
+        auto & bucket{ m_buckets.back() };
+
+        bucket.minimum = std::min( bucket.minimum, timestamp );
+        bucket.maximum = std::max( bucket.maximum, timestamp );
+        bucket.ceiling = std::max( bucket.ceiling, timestamp );
+    }
+
+    ++m_count;
+}
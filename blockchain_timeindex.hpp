@@ -0,0 +1,46 @@
+#pragma once
+
+#include "blockchain.hpp"
+#include <functional>
+
+namespace bitchat {
+
+class Blockchain::TimeIndex : private boost::noncopyable
+{
+    struct Bucket
+    {
+        std::int64_t minimum;
+        std::int64_t maximum;
+        std::int64_t ceiling;   //! maximum timestamp of this and all previous buckets
+    };
+
+public:
+    //! Loads up to count blocks from begin, returns how many it loaded
+    using Loader = std::function<std::uint64_t ( const std::uint64_t begin,
+                                                 const std::uint64_t count,
+                                                 Block * blocks )>;
+
+    static constexpr auto kBucketSize{ 64 };
+
+    TimeIndex();
+
+    void reset();
+    //! Indexes a committed block from memory. It is left for the next query to load
+    //! while a query holds the index or the blocks before it aren't indexed yet
+    void append( const Block & block );
+
+    std::vector<std::uint64_t> find( const std::int64_t from,
+                                     const std::int64_t to,
+                                     const std::uint64_t count,
+                                     const Loader & load );
+
+private:
+    void extend( const std::int64_t timestamp );
+
+private:
+    std::uint64_t m_count;
+    std::vector<Bucket> m_buckets;
+    std::mutex m_mutex;
+};
+
+} // bitchat
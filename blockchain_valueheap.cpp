@@ -0,0 +1,136 @@
+#include "blockchain_valueheap.hpp"
+#include "hasher.hpp"
+#include <boost/log/trivial.hpp>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+using bitchat::Blockchain;
+
+Blockchain::ValueHeap::ValueHeap( const std::string & path ) :
+    m_path{ path },
+    m_descriptor{ -1 }
+{
+}
+
+Blockchain::ValueHeap::~ValueHeap()
+{
+    close();
+}
+
+std::uint64_t Blockchain::ValueHeap::open()
+{
+    m_descriptor = openFile( m_path, O_CREAT | O_RDWR );
+
+    if ( m_descriptor < 0 )
+    {
+        throwLastError( "Failed to open the value heap" );
+    }
+
+    return static_cast<std::uint64_t>( ::lseek64( m_descriptor, 0, SEEK_END ) );
+}
+
+void Blockchain::ValueHeap::close()
+{
+    if ( m_descriptor >= 0 )
+    {
+        ::close( m_descriptor );
+        m_descriptor = -1;
+    }
+}
+
+void Blockchain::ValueHeap::truncate( const std::uint64_t size )
+{
+    if ( ::ftruncate64( m_descriptor, static_cast<std::int64_t>( size ) ) != 0 )
+    {
+        throwLastError( "Failed to truncate the value heap" );
+    }
+}
+
+void Blockchain::ValueHeap::sync()
+{
+    if ( m_descriptor >= 0 && ::fdatasync( m_descriptor ) != 0 )
+    {
+        BOOST_LOG_TRIVIAL( error ) << "Failed to sync the value heap";
+    }
+}
+
+void Blockchain::ValueHeap::write( const Reference & reference,
+                                   const std::string & value )
+{
+    //! Every node writes the values of a chain at the same offsets, so rewriting
+    //! a value after a crash puts the same bytes in the same place
+    for ( auto written{ 0ull }; written < value.size(); )
+    {
+        const auto result{ ::pwrite64( m_descriptor,
+                                       value.data() + written,
+                                       value.size() - written,
+                                       static_cast<std::int64_t>( reference.offset + written ) ) };
+
+        if ( result <= 0 )
+        {
+            throwLastError( "Failed to write the value heap" );
+        }
+
+        written += static_cast<std::uint64_t>( result );
+    }
+}
+
+std::string Blockchain::ValueHeap::read( const Reference & reference )
+{
+    Block::Sha256 hash{};
+
+    if ( reference.length > kMaximumValueSize )
+    {
+        throw std::runtime_error( "The value at " + std::to_string( reference.offset ) + " is longer than any value" );
+    }
+
+    std::string result( reference.length, '\0' );
+
+    if ( ::pread64( m_descriptor, & result.front(), result.size(),
+                    static_cast<std::int64_t>( reference.offset ) ) != static_cast<ssize_t>( result.size() ) )
+    {
+        throw std::runtime_error( "The value at " + std::to_string( reference.offset ) + " is missing from the value heap" );
+    }
+
+    Hasher::hash( result.data(), result.size(), hash.data() );
+
+    if ( hash != reference.hash )
+    {
+        throw std::runtime_error( "The value at " + std::to_string( reference.offset ) + " doesn't match its hash" );
+    }
+
+    return result;
+}
+
+Blockchain::Block::Value Blockchain::ValueHeap::makeReference( const std::uint64_t offset,
+                                                               const std::string & value )
+{
+    BOOST_ASSERT( kEnabled );
+    Block::Value result{};
+    Reference reference{};
+
+    reference.marker = '\0';
+    reference.offset = offset;
+    reference.length = static_cast<std::uint32_t>( value.size() );
+    Hasher::hash( value.data(), value.size(), reference.hash.data() );
+
+    std::memcpy( result.data(), & reference, std::min( sizeof( reference ), result.size() ) );
+
+    return result;
+}
+
+bool Blockchain::ValueHeap::getReference( const Block::Value & value,
+                                          Reference & reference )
+{
+    //! An empty value is all zeros, so a reference is told apart by its length
+    if ( ! kEnabled || value.front() != '\0' )
+    {
+        return false;
+    }
+
+    std::memcpy( & reference, value.data(), std::min( sizeof( reference ), value.size() ) );
+
+    return reference.length > 0;
+}
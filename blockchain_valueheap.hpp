@@ -0,0 +1,48 @@
+#pragma once
+
+#include "blockchain_block.hpp"
+
+namespace bitchat {
+
+class Blockchain::ValueHeap : private boost::noncopyable
+{
+public:
+#pragma pack(push, 1)
+
+    //! Stored in the value field of a block in place of a value too long for it
+    struct Reference
+    {
+        char marker;            //! zero, an inlined value never starts with it
+        std::uint64_t offset;   //! where the value starts in the heap
+        std::uint32_t length;
+        Block::Sha256 hash;     //! the hash of the value, covered by the block hash
+    };
+
+#pragma pack(pop)
+
+    //! A layout whose value field can't hold a reference inlines everything
+    static constexpr bool kEnabled{ sizeof( Reference ) <= kValueSize };
+
+    explicit ValueHeap( const std::string & path );
+    ~ValueHeap();
+
+    std::uint64_t open();
+    void close();
+    void truncate( const std::uint64_t size );
+    void sync();
+
+    void write( const Reference & reference,
+                const std::string & value );
+    std::string read( const Reference & reference );
+
+    static Block::Value makeReference( const std::uint64_t offset,
+                                       const std::string & value );
+    static bool getReference( const Block::Value & value,
+                              Reference & reference );
+
+private:
+    const std::string m_path;
+    int m_descriptor;
+};
+
+} // bitchat
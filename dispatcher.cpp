@@ -17,6 +17,7 @@ constexpr auto kMessagePromt{ "Type your message: " };
 Dispatcher::Dispatcher( Console & console,
                         Network & network,
                         Blockchain & blockchain ) :
+    m_savedIndex{ 0 },
     m_console{ console },
     m_network{ network },
     m_blockchain{ blockchain }
@@ -81,9 +82,11 @@ bool Dispatcher::onChannelOpened( void * arg )
         {
             if ( arg == client.get() )
             {
-                client->write( m_blockchain.makeBlockRequest( 0 ) );
+                //! Catch up from the local head, a range at a time
+                client->writeFrame( m_blockchain.makeBlocksRequest( m_blockchain.getHeadIndex() + 1,
+                                                               Blockchain::kRangeBlocks ) );
                 communication->getIos().
-                        post( std::bind( & Dispatcher::readClientResponse, this, client.get() ) );
+                        post( std::bind( & Dispatcher::readClientResponse, this, client ) );
             }
         }
     }
@@ -97,6 +100,18 @@ bool Dispatcher::onChannelClosed( void * arg )
     BOOST_ASSERT( channel != nullptr );
     const auto communication{ channel->getCommunication().get() };
 
+    do
+    {
+        std::lock_guard<std::mutex> lock{ m_forksMutex };
+        m_forks.erase( arg );
+    } while( false );
+
+    do
+    {
+        std::lock_guard<std::mutex> lock{ m_requestedMutex };
+        m_requested.erase( arg );
+    } while( false );
+
     if ( arg == & m_console )
     {
         BOOST_LOG_TRIVIAL( debug ) << "The console closed - " << channel;
@@ -117,22 +132,48 @@ bool Dispatcher::onChannelClosed( void * arg )
 bool Dispatcher::onBlochainSaved( void * arg )
 {
     std::stringstream stream{};
+    const auto headIndex{ m_blockchain.getHeadIndex() };
+    //! One notification is sent per committed batch, show every block since the last one
+    const auto savedIndex{ m_savedIndex.exchange( headIndex ) };
+    const auto firstIndex{ arg == nullptr ? headIndex : savedIndex + 1 };
 
-    if ( m_blockchain.getHeadIndex() > 0 )
+    for ( auto index{ std::max<std::uint64_t>( firstIndex, 1 ) }; index <= headIndex; ++index )
     {
         for ( auto i{ std::strlen( kMessagePromt ) }; i > 0; --i )
         {
             stream << '\b';
         }
-        stream << m_blockchain.getHeadTimestamp() << ' ';
-        stream << m_blockchain.getHeadKey() << '>';
-        stream << m_blockchain.getHeadValue() << std::endl;
-        m_console.write( stream.str() );
+        stream << m_blockchain.getTimestamp( index ) << ' ';
+        stream << m_blockchain.getKey( index ) << '>';
 
-        for ( const auto client : m_clients )
+        try
+        {
+            stream << m_blockchain.getValue( index ) << std::endl;
+        }
+        catch ( const std::runtime_error & error )
         {
-            client->write( m_blockchain.makeNewBlock( 0 ) );
+            BOOST_LOG_TRIVIAL( error ) << "Failed to read the value of block " << index << " - " << error.what();
+            stream << std::endl;
         }
+
+    }
+
+    //! Only the last block of the batch is announced, the peers which miss it
+    //! fetch the headers up to it and then the blocks they don't have.
+    //! The frames are only queued, a slow peer holds up none of the others
+    if ( headIndex >= firstIndex && headIndex > 0 )
+    {
+        const auto inventory{ m_blockchain.makeInventory( headIndex ) };
+
+        for ( const auto & peer : getPeers() )
+        {
+            peer->writeFrame( inventory );
+        }
+    }
+
+    if ( stream.tellp() > 0 )
+    {
+        m_console.write( stream.str() );
     }
 
     if ( arg != nullptr )
@@ -167,7 +208,7 @@ void Dispatcher::promptMessage()
     const auto message{ m_console.read( 0 ) };
 
     if ( ! message.empty() &&
-         message.size() <= Blockchain::kValueSize )
+         message.size() <= Blockchain::getMaximumValueSize() )
     {
         m_console.getCommunication()->getIos().
                 post( std::bind( & Blockchain::store, & m_blockchain, m_email, message ) );
@@ -176,46 +217,371 @@ void Dispatcher::promptMessage()
 
 void Dispatcher::readServerRequest()
 {
-    const auto server{ m_network.getServerSocket() };
+    readMessage( m_network.getServerSocket() );
+}
+
+void Dispatcher::readClientResponse( const ChannelPtr & client )
+{
+    readMessage( client );
+}
 
-    switch ( server->read( 1 )[ 0 ] )
+void Dispatcher::readMessage( const ChannelPtr & channel )
+{
+    //! Both sides of a connection ask and answer, so every channel takes every message.
+    //! Nothing blocks on a peer, the frames are handed out as the socket reads complete them
+    channel->readFrames( [ this, channel ]( const boost::system::error_code & error,
+                                            const char tag,
+                                            const std::string & payload ) {
+        if ( error )
+        {
+            closeChannel( channel, error );
+            return false;
+        }
+
+        try
+        {
+            readFrame( channel, tag, payload );
+        }
+        catch ( const boost::system::system_error & error )
+        {
+            closeChannel( channel, error.code() );
+        }
+        catch ( const std::runtime_error & error )
+        {
+            //! A block the chain can't read fails the message alone, not the node
+            BOOST_LOG_TRIVIAL( error ) << "Failed to handle a message - " << error.what();
+        }
+
+        return channel->isOpen();
+    } );
+}
+
+void Dispatcher::readFrame( const ChannelPtr & channel,
+                            const char tag,
+                            const std::string & payload )
+{
+    const auto indexSize{ m_blockchain.makeBlockRequest( 0 ).size() - 1 };
+    const auto rangeSize{ m_blockchain.makeBlocksRequest( 0, 0 ).size() - 1 };
+
+    switch ( tag )
     {
     case Blockchain::kRequestBlock:
-        writeServerResponce();
+        if ( checkPayload( channel, payload, indexSize ) )
+        {
+            writeBlockResponse( channel, payload );
+        }
         break;
 
+    //! A block asked for is checked and linked like an announced one,
+    //! save drops it unless it extends the chain
+    case Blockchain::kResponseBlock:
     case Blockchain::kNewBlock:
-        m_blockchain.save( readRawBlock( server.get() ) );
+        if ( checkPayload( channel, payload, m_blockchain.getBlockSize() ) )
+        {
+            m_blockchain.save( payload );
+        }
+        break;
+
+    case Blockchain::kRequestRoot:
+        if ( checkPayload( channel, payload, indexSize ) )
+        {
+            writeRootResponse( channel, payload );
+        }
+        break;
+
+    case Blockchain::kResponseRoot:
+        if ( checkPayload( channel, payload, indexSize + Blockchain::getRootSize() ) )
+        {
+            readRootResponse( channel, payload );
+        }
+        break;
+
+    case Blockchain::kNewValue:
+        if ( payload.size() >= indexSize &&
+             checkPayload( channel, payload, indexSize + Blockchain::extractBlockIndex( payload ) ) )
+        {
+            readValue( channel, payload.substr( indexSize ) );
+        }
+        break;
+
+    case Blockchain::kRequestBlocks:
+        if ( checkPayload( channel, payload, rangeSize ) )
+        {
+            writeBlocksResponse( channel, payload );
+        }
+        break;
+
+    case Blockchain::kResponseBlocks:
+        if ( payload.size() >= rangeSize &&
+             checkPayload( channel, payload, rangeSize + m_blockchain.getBlockSize() *
+                           Blockchain::extractBlockIndex( payload.substr( rangeSize / 2 ) ) ) )
+        {
+            readBlocksResponse( channel, payload );
+        }
+        break;
+
+    case Blockchain::kInventory:
+        if ( checkPayload( channel, payload, Blockchain::getInventorySize() ) )
+        {
+            readInventory( channel, payload );
+        }
+        break;
+
+    case Blockchain::kRequestHeaders:
+        if ( checkPayload( channel, payload, rangeSize ) )
+        {
+            writeHeadersResponse( channel, payload );
+        }
+        break;
+
+    case Blockchain::kResponseHeaders:
+        if ( payload.size() >= rangeSize &&
+             checkPayload( channel, payload, rangeSize + Blockchain::getHeaderSize() *
+                           Blockchain::extractBlockIndex( payload.substr( rangeSize / 2 ) ) ) )
+        {
+            readHeadersResponse( channel, payload );
+        }
+        break;
+
+    default:
+        BOOST_LOG_TRIVIAL( warning ) << "Closing a channel which sent an unknown message";
+        channel->close();
         break;
     }
 }
 
-void Dispatcher::writeServerResponce()
+bool Dispatcher::checkPayload( const ChannelPtr & channel,
+                               const std::string & payload,
+                               const std::size_t size )
 {
-    const auto indexSize{ m_blockchain.makeBlockRequest( 0 ).size() - 1 };
-    const auto indexData{ m_network.getServerSocket()->read( indexSize ) };
-    const auto index{ Blockchain::extractBlockIndex( indexData ) };
+    //! The length of a frame must agree with what its own fields say
+    if ( payload.size() != size )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Closing a channel which sent a malformed message of "
+                                     << payload.size() << " bytes";
+        channel->close();
+        return false;
+    }
 
-    m_network.getServerSocket()->write( m_blockchain.makeBlockResponse( index ) );
+    return true;
 }
 
-void Dispatcher::readClientResponse( Channel * client )
+void Dispatcher::closeChannel( const ChannelPtr & channel,
+                               const boost::system::error_code & error )
 {
-    switch ( m_network.getServerSocket()->read( 1 )[ 0 ] )
+    //! A channel closed locally aborts its pending read
+    if ( error != boost::asio::error::operation_aborted )
     {
-    case Blockchain::kResponseBlock:
-        //! TODO: complete blockchain integrity
-        break;
+        BOOST_LOG_TRIVIAL( info ) << "Lost a peer - " << error.message();
+    }
 
-    case Blockchain::kNewBlock:
-        m_blockchain.save( readRawBlock( client ) );
-        break;
+    if ( channel->isOpen() )
+    {
+        channel->close();
     }
 }
 
-std::string Dispatcher::readRawBlock( Channel * channel  )
+void Dispatcher::writeBlockResponse( const ChannelPtr & channel,
+                                     const std::string & data )
 {
-    const auto size{ m_blockchain.getBlockSize() };
-    return channel->read( size );
+    const auto index{ Blockchain::extractBlockIndex( data ) };
+
+    m_blockchain.makeBlockResponse( index, [ channel ]( std::string message,
+                                                        const Blockchain::View & data,
+                                                        const std::size_t size ) {
+        channel->writeFrame( std::move( message ), data, size );
+    } );
+}
+
+void Dispatcher::writeBlocksResponse( const ChannelPtr & channel,
+                                      const std::string & data )
+{
+    const auto index{ Blockchain::extractBlockIndex( data ) };
+    const auto count{ Blockchain::extractBlockIndex( data.substr( data.size() / 2 ) ) };
+
+    m_blockchain.makeBlocksResponse( index, count, [ channel ]( std::string message,
+                                                                const Blockchain::View & data,
+                                                                const std::size_t size ) {
+        channel->writeFrame( std::move( message ), data, size );
+    } );
+}
+
+void Dispatcher::writeHeadersResponse( const ChannelPtr & channel,
+                                       const std::string & data )
+{
+    const auto index{ Blockchain::extractBlockIndex( data ) };
+    const auto count{ Blockchain::extractBlockIndex( data.substr( data.size() / 2 ) ) };
+
+    channel->writeFrame( m_blockchain.makeHeadersResponse( index, count ) );
+}
+
+void Dispatcher::writeRootResponse( const ChannelPtr & channel,
+                                    const std::string & data )
+{
+    const auto count{ Blockchain::extractBlockIndex( data ) };
+
+    channel->writeFrame( m_blockchain.makeRootResponse( count ) );
+}
+
+void Dispatcher::readBlocksResponse( const ChannelPtr & channel,
+                                     const std::string & data )
+{
+    const auto rangeSize{ m_blockchain.makeBlocksRequest( 0, 0 ).size() - 1 };
+    const auto index{ Blockchain::extractBlockIndex( data ) };
+    const auto count{ Blockchain::extractBlockIndex( data.substr( rangeSize / 2 ) ) };
+
+    if ( count > Blockchain::kRangeBlocks )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Closing a channel which sent a range of " << count << " blocks";
+        channel->close();
+        return;
+    }
+
+    for ( auto i{ 0ull }; i < count; ++i )
+    {
+        m_blockchain.save( data.substr( rangeSize + i * m_blockchain.getBlockSize(), m_blockchain.getBlockSize() ) );
+    }
+
+    //! An empty range means the peer has nothing past it
+    if ( count > 0 )
+    {
+        channel->writeFrame( m_blockchain.makeBlocksRequest( index + count, Blockchain::kRangeBlocks ) );
+    }
+}
+
+void Dispatcher::readHeadersResponse( const ChannelPtr & channel,
+                                      const std::string & data )
+{
+    const auto rangeSize{ m_blockchain.makeHeadersRequest( 0, 0 ).size() - 1 };
+    const auto index{ Blockchain::extractBlockIndex( data ) };
+    const auto count{ Blockchain::extractBlockIndex( data.substr( rangeSize / 2 ) ) };
+
+    if ( count > Blockchain::kRangeHeaders )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Closing a channel which sent " << count << " headers";
+        channel->close();
+        return;
+    }
+
+    //! Only the blocks whose headers continue the local chain are fetched
+    const auto linked{ m_blockchain.saveHeaders( data.substr( rangeSize ) ) };
+
+    if ( linked > 0 )
+    {
+        channel->writeFrame( m_blockchain.makeBlocksRequest( index, linked ) );
+    }
+    else if ( count > 0 )
+    {
+        //! The peer went another way, the roots of both chains tell from where
+        findFork( channel );
+    }
+}
+
+void Dispatcher::findFork( const ChannelPtr & channel )
+{
+    std::lock_guard<std::mutex> lock{ m_forksMutex };
+    const Blockchain::Fork fork{ 0, m_blockchain.getHeadIndex() + 1 };
+
+    if ( m_forks.emplace( channel.get(), fork ).second )
+    {
+        channel->writeFrame( m_blockchain.makeRootRequest( fork.different ) );
+    }
+}
+
+void Dispatcher::readRootResponse( const ChannelPtr & channel,
+                                   const std::string & data )
+{
+    std::lock_guard<std::mutex> lock{ m_forksMutex };
+    const auto fork{ m_forks.find( channel.get() ) };
+
+    if ( fork == m_forks.end() )
+    {
+        return;
+    }
+
+    const auto count{ Blockchain::extractBlockIndex( data ) };
+    const auto next{ m_blockchain.findFork( fork->second, count, data.substr( sizeof( count ) ) ) };
+
+    if ( next > 0 )
+    {
+        channel->writeFrame( m_blockchain.makeRootRequest( next ) );
+        return;
+    }
+
+    //! Switching to another chain isn't supported, the blocks past the fork are only reported
+    if ( fork->second.same < fork->second.different )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "A peer has a different chain from block " << fork->second.same;
+    }
+    else
+    {
+        BOOST_LOG_TRIVIAL( debug ) << "A peer has the same chain up to block " << fork->second.same;
+    }
+
+    m_forks.erase( fork );
+}
+
+void Dispatcher::readInventory( const ChannelPtr & channel,
+                                const std::string & data )
+{
+    const auto index{ Blockchain::extractBlockIndex( data ) };
+    const auto hash{ data.substr( sizeof( index ) ) };
+    const auto headIndex{ m_blockchain.getHeadIndex() };
+
+    //! A peer is asked once for the blocks it announces, so a peer which doesn't
+    //! answer doesn't hold back the blocks announced by the others
+    if ( index > headIndex && ! m_blockchain.hasBlock( index, hash ) )
+    {
+        do
+        {
+            std::lock_guard<std::mutex> lock{ m_requestedMutex };
+            auto & requested{ m_requested[ channel.get() ] };
+
+            if ( requested >= index )
+            {
+                return;
+            }
+
+            requested = index;
+        } while( false );
+
+        const auto first{ headIndex + 1 };
+
+        channel->writeFrame( m_blockchain.makeHeadersRequest( first, std::min( index - first + 1, Blockchain::kRangeHeaders ) ) );
+    }
+}
+
+void Dispatcher::readValue( const ChannelPtr & channel,
+                            const std::string & data )
+{
+    if ( data.size() > Blockchain::getMaximumValueSize() )
+    {
+        BOOST_LOG_TRIVIAL( warning ) << "Closing a channel which sent a value of " << data.size() << " bytes";
+        channel->close();
+        return;
+    }
+
+    m_blockchain.saveValue( data );
+}
+
+std::vector<Dispatcher::ChannelPtr> Dispatcher::getPeers() const
+{
+    const auto server{ m_network.getServerSocket() };
+    std::vector<ChannelPtr> result{};
+
+    for ( const auto & client : m_network.getClientSockets() )
+    {
+        if ( client->isOpen() )
+        {
+            result.emplace_back( client );
+        }
+    }
+
+    if ( server && server->isOpen() )
+    {
+        result.emplace_back( server );
+    }
+
+    return result;
 }
 
@@ -1,18 +1,24 @@
 #pragma once
 
+#include "blockchain.hpp"
 #include <boost/asio/io_service.hpp>
+#include <boost/system/error_code.hpp>
+#include <atomic>
+#include <mutex>
+#include <map>
 
 namespace bitchat {
 
 class Channel;
+class SocketChannel;
 class Console;
 class Network;
-class Blockchain;
 class Communication;
 
 class Dispatcher : boost::noncopyable
 {
     using Work = boost::asio::io_service::work;
+    using ChannelPtr = std::shared_ptr<SocketChannel>;
 
 public:
     Dispatcher( Console & console,
@@ -32,19 +38,51 @@ private:
     
 
     void readServerRequest();
-    void writeServerResponce();
+    void readClientResponse( const ChannelPtr & client );
+    void readMessage( const ChannelPtr & channel );
+    void readFrame( const ChannelPtr & channel,
+                    const char tag,
+                    const std::string & payload );
+    bool checkPayload( const ChannelPtr & channel,
+                       const std::string & payload,
+                       const std::size_t size );
+    void closeChannel( const ChannelPtr & channel,
+                       const boost::system::error_code & error );
 
-    void readClientResponse( Channel * client );
+    void writeBlockResponse( const ChannelPtr & channel,
+                             const std::string & data );
+    void writeBlocksResponse( const ChannelPtr & channel,
+                              const std::string & data );
+    void writeHeadersResponse( const ChannelPtr & channel,
+                               const std::string & data );
+    void writeRootResponse( const ChannelPtr & channel,
+                            const std::string & data );
 
-    std::string readRawBlock( Channel * channel );
+    void readBlocksResponse( const ChannelPtr & channel,
+                             const std::string & data );
+    void readHeadersResponse( const ChannelPtr & channel,
+                              const std::string & data );
+    void readInventory( const ChannelPtr & channel,
+                        const std::string & data );
+    void readRootResponse( const ChannelPtr & channel,
+                           const std::string & data );
+    void findFork( const ChannelPtr & channel );
+    void readValue( const ChannelPtr & channel,
+                    const std::string & data );
+
+    std::vector<ChannelPtr> getPeers() const;
 
 private:
     std::string m_email;
+    std::atomic<std::uint64_t> m_savedIndex;
     std::unique_ptr<Work> m_work;
     Console & m_console;
     Network & m_network;
     Blockchain & m_blockchain;
-    std::vector<Channel*> m_clients;
+    std::mutex m_forksMutex;
+    std::map<const void*, Blockchain::Fork> m_forks;    //! the searches for a fork by their peers
+    std::mutex m_requestedMutex;
+    std::map<const void*, std::uint64_t> m_requested;   //! the last block asked of a peer after its announcements
 };
 
 } // bitchat
@@ -44,22 +44,15 @@ bool FileChannel::isOpen() const
 std::string FileChannel::read( const std::size_t size )
 {
     std::string result{};
-    boost::asio::streambuf buffer{};
-    auto readed{ 0ull };
 
-    if ( size == 0 )
-    {
-        readed = boost::asio::read_until( * this, buffer, kEndLine );
-    }
-    else
+    if ( size > 0 )
     {
         result.resize( size );
-        readed = boost::asio::read( * this, buffer );
+        read( & result.front(), size );
     }
-
-    if ( readed > 0 )
+    else if ( boost::asio::read_until( * this, m_line, kEndLine ) > 0 )
     {
-        std::istream input{ & buffer };
+        std::istream input{ & m_line };
         std::getline( input, result );
     }
 
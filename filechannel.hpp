@@ -3,6 +3,7 @@
 #include "channel.hpp"
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/streambuf.hpp>
 
 namespace bitchat {
 
@@ -30,6 +31,7 @@ public:
 
 private:
     CommunicationPtr m_communication;
+    boost::asio::streambuf m_line;  //! keeps what was read past the end of a line
 };
 
 } // bitchat
@@ -0,0 +1,140 @@
+#include "framebuffer.hpp"
+#include <boost/asio/error.hpp>
+#include <boost/assert.hpp>
+#include <boost/system/system_error.hpp>
+#include <algorithm>
+#include <cstring>
+
+using bitchat::FrameBuffer;
+
+constexpr std::size_t FrameBuffer::kHeaderSize;
+constexpr std::size_t FrameBuffer::kMaximumLength;
+
+FrameBuffer::FrameBuffer( const std::size_t capacity ) :
+    m_data( std::max( capacity, kHeaderSize ) ),
+    m_begin{ 0 },
+    m_size{ 0 }
+{
+}
+
+FrameBuffer::MutableBuffers FrameBuffer::prepare()
+{
+    const auto end{ ( m_begin + m_size ) % m_data.size() };
+    MutableBuffers result{};
+
+    if ( m_size == m_data.size() )
+    {
+        return result;
+    }
+
+    if ( end >= m_begin )
+    {
+        result[ 0 ] = boost::asio::buffer( m_data.data() + end, m_data.size() - end );
+        result[ 1 ] = boost::asio::buffer( m_data.data(), m_begin );
+    }
+    else
+    {
+        result[ 0 ] = boost::asio::buffer( m_data.data() + end, m_begin - end );
+    }
+
+    return result;
+}
+
+void FrameBuffer::commit( const std::size_t size )
+{
+    BOOST_ASSERT( m_size + size <= m_data.size() );
+    m_size += size;
+}
+
+bool FrameBuffer::next( char & tag,
+                        std::string & payload )
+{
+    char header[ kHeaderSize ]{};
+    Length length{ 0 };
+
+    if ( m_size < kHeaderSize )
+    {
+        return false;
+    }
+
+    peek( 0, kHeaderSize, header );
+    std::memcpy( & length, header + 1, sizeof( length ) );
+
+    if ( length > kMaximumLength )
+    {
+        throw boost::system::system_error{ boost::asio::error::message_size };
+    }
+
+    //! The whole frame must fit for the socket to read the rest of it
+    if ( kHeaderSize + length > m_data.size() )
+    {
+        reserve( kHeaderSize + length );
+    }
+
+    if ( m_size < kHeaderSize + length )
+    {
+        return false;
+    }
+
+    tag = header[ 0 ];
+    payload.resize( length );
+
+    if ( length > 0 )
+    {
+        peek( kHeaderSize, length, & payload.front() );
+    }
+
+    consume( kHeaderSize + length );
+
+    return true;
+}
+
+std::size_t FrameBuffer::getSize() const
+{
+    return m_size;
+}
+
+void FrameBuffer::encodeHeader( const char tag,
+                                const std::size_t length,
+                                char * header )
+{
+    const Length value( length );
+
+    BOOST_ASSERT( length <= kMaximumLength );
+
+    header[ 0 ] = tag;
+    std::memcpy( header + 1, & value, sizeof( value ) );
+}
+
+void FrameBuffer::peek( const std::size_t offset,
+                        const std::size_t size,
+                        char * data ) const
+{
+    //! Expects offset + size to be within the unread bytes
+    const auto begin{ ( m_begin + offset ) % m_data.size() };
+    const auto first{ std::min( size, m_data.size() - begin ) };
+
+    std::memcpy( data, m_data.data() + begin, first );
+    std::memcpy( data + first, m_data.data(), size - first );
+}
+
+void FrameBuffer::consume( const std::size_t size )
+{
+    m_begin = ( m_begin + size ) % m_data.size();
+    m_size -= size;
+
+    //! An empty ring starts over so the next read gets the whole buffer in one piece
+    if ( m_size == 0 )
+    {
+        m_begin = 0;
+    }
+}
+
+void FrameBuffer::reserve( const std::size_t capacity )
+{
+    std::vector<char> data( std::max( capacity, m_data.size() * 2 ) );
+
+    peek( 0, m_size, data.data() );
+    m_data.swap( data );
+    m_begin = 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+#include <boost/noncopyable.hpp>
+#include <array>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace bitchat {
+
+//! The receive buffer of a connection, a ring the socket reads into as much as fits
+//! and complete frames are cut out of. A frame is the tag, the length of the payload
+//! and the payload
+class FrameBuffer : private boost::noncopyable
+{
+public:
+    using Length = std::uint32_t;
+    using MutableBuffers = std::array<boost::asio::mutable_buffer, 2>;
+
+    static constexpr std::size_t kHeaderSize{ 1 + sizeof( Length ) };
+    static constexpr std::size_t kCapacity{ 64 * 1024 };  //! 64KB, grows to hold a longer frame
+    static constexpr std::size_t kMaximumLength{ 16 * 1024 * 1024 };   //! 16MB
+
+    explicit FrameBuffer( const std::size_t capacity = kCapacity );
+
+    //! The free space, split in two where it wraps around
+    MutableBuffers prepare();
+    void commit( const std::size_t size );
+
+    //! Takes the next complete frame out, false when it hasn't arrived in full yet.
+    //! Throws when the frame is longer than kMaximumLength
+    bool next( char & tag,
+               std::string & payload );
+
+    std::size_t getSize() const;
+
+    static void encodeHeader( const char tag,
+                              const std::size_t length,
+                              char * header );
+
+private:
+    void peek( const std::size_t offset,
+               const std::size_t size,
+               char * data ) const;
+    void consume( const std::size_t size );
+    void reserve( const std::size_t capacity );
+
+private:
+    std::vector<char> m_data;
+    std::size_t m_begin;    //! where the unread bytes start
+    std::size_t m_size;     //! how many bytes are unread
+};
+
+} // bitchat
@@ -0,0 +1,505 @@
+#include "hasher.hpp"
+#include "picosha2.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <cpuid.h>
+#include <immintrin.h>
+#define BITCHAT_HASHER_X86
+#endif
+
+using bitchat::Hasher;
+
+namespace
+{
+using Word = std::uint32_t;
+using State = std::array<Word, 8>;
+
+constexpr auto kChunkSize{ Hasher::kChunkSize };
+constexpr auto kTailSize{ 2 * kChunkSize };
+
+constexpr State kInitial{ {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+} };
+
+alignas( 16 ) constexpr Word kRounds[ 64 ]{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+//! Copies the incomplete last chunk of a message into the tail and pads it
+//! for the given total length, returns the number of chunks in the tail
+std::size_t makeTail( const std::uint8_t * data,
+                      const std::size_t size,
+                      const std::uint64_t length,
+                      std::uint8_t * tail )
+{
+    const auto rest{ size % kChunkSize };
+    const auto chunks{ rest + 9 > kChunkSize ? 2u : 1u };
+    const auto bits{ length * 8 };
+
+    std::memset( tail, 0, kTailSize );
+    std::memcpy( tail, data + size - rest, rest );
+    tail[ rest ] = 0x80;
+
+    for ( auto i{ 0u }; i < 8; ++i )
+    {
+        tail[ chunks * kChunkSize - 1 - i ] = static_cast<std::uint8_t>( bits >> ( 8 * i ) );
+    }
+
+    return chunks;
+}
+
+Word readWord( const std::uint8_t * data )
+{
+    return static_cast<Word>( data[ 0 ] ) << 24 |
+           static_cast<Word>( data[ 1 ] ) << 16 |
+           static_cast<Word>( data[ 2 ] ) << 8 |
+           static_cast<Word>( data[ 3 ] );
+}
+
+void writeWord( const Word word,
+                char * digest )
+{
+    digest[ 0 ] = static_cast<char>( word >> 24 );
+    digest[ 1 ] = static_cast<char>( word >> 16 );
+    digest[ 2 ] = static_cast<char>( word >> 8 );
+    digest[ 3 ] = static_cast<char>( word );
+}
+
+Word rotateWord( const Word value,
+                 const int count )
+{
+    return value >> count | value << ( 32 - count );
+}
+
+void compressPortable( Word * state,
+                       const std::uint8_t * data,
+                       std::size_t chunks )
+{
+    for ( ; chunks > 0; --chunks, data += kChunkSize )
+    {
+        Word words[ 64 ];
+        auto a{ state[ 0 ] }, b{ state[ 1 ] }, c{ state[ 2 ] }, d{ state[ 3 ] };
+        auto e{ state[ 4 ] }, f{ state[ 5 ] }, g{ state[ 6 ] }, h{ state[ 7 ] };
+
+        for ( auto round{ 0u }; round < 64; ++round )
+        {
+            if ( round < 16 )
+            {
+                words[ round ] = readWord( data + round * sizeof( Word ) );
+            }
+            else
+            {
+                const auto w15{ words[ round - 15 ] };
+                const auto w2{ words[ round - 2 ] };
+                const auto s0{ rotateWord( w15, 7 ) ^ rotateWord( w15, 18 ) ^ ( w15 >> 3 ) };
+                const auto s1{ rotateWord( w2, 17 ) ^ rotateWord( w2, 19 ) ^ ( w2 >> 10 ) };
+
+                words[ round ] = words[ round - 16 ] + s0 + words[ round - 7 ] + s1;
+            }
+
+            const auto sum1{ rotateWord( e, 6 ) ^ rotateWord( e, 11 ) ^ rotateWord( e, 25 ) };
+            const auto choose{ ( e & f ) ^ ( ~e & g ) };
+            const auto sum0{ rotateWord( a, 2 ) ^ rotateWord( a, 13 ) ^ rotateWord( a, 22 ) };
+            const auto majority{ ( a & b ) | ( c & ( a | b ) ) };
+            const auto first{ h + sum1 + choose + kRounds[ round ] + words[ round ] };
+            const auto second{ sum0 + majority };
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + first;
+            d = c;
+            c = b;
+            b = a;
+            a = first + second;
+        }
+
+        state[ 0 ] += a;
+        state[ 1 ] += b;
+        state[ 2 ] += c;
+        state[ 3 ] += d;
+        state[ 4 ] += e;
+        state[ 5 ] += f;
+        state[ 6 ] += g;
+        state[ 7 ] += h;
+    }
+}
+
+void hashPortable( const char * data,
+                   const std::size_t size,
+                   char * digest )
+{
+    picosha2::hash256( data, data + size, digest, digest + Hasher::kDigestSize );
+}
+
+#ifdef BITCHAT_HASHER_X86
+
+__attribute__(( target( "sha,sse4.1" ) ))
+void compressShaNi( Word * state,
+                    const std::uint8_t * data,
+                    std::size_t chunks )
+{
+    const auto mask{ _mm_set_epi64x( 0x0c0d0e0f08090a0bull, 0x0405060700010203ull ) };
+    auto temp{ _mm_shuffle_epi32( _mm_loadu_si128( reinterpret_cast<const __m128i *>( state ) ), 0xb1 ) };
+    auto cdgh{ _mm_shuffle_epi32( _mm_loadu_si128( reinterpret_cast<const __m128i *>( state + 4 ) ), 0x1b ) };
+    auto abef{ _mm_alignr_epi8( temp, cdgh, 8 ) };
+
+    cdgh = _mm_blend_epi16( cdgh, temp, 0xf0 );
+
+    for ( ; chunks > 0; --chunks, data += kChunkSize )
+    {
+        const auto savedAbef{ abef };
+        const auto savedCdgh{ cdgh };
+        __m128i words[ 4 ];
+
+        for ( auto group{ 0u }; group < 16; ++group )
+        {
+            auto & current{ words[ group % 4 ] };
+
+            if ( group < 4 )
+            {
+                current = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i *>( data + group * 16 ) ), mask );
+            }
+            else
+            {
+                const auto & previous{ words[ ( group + 3 ) % 4 ] };
+                const auto shifted{ _mm_alignr_epi8( previous, words[ ( group + 2 ) % 4 ], 4 ) };
+
+                current = _mm_sha256msg1_epu32( current, words[ ( group + 1 ) % 4 ] );
+                current = _mm_sha256msg2_epu32( _mm_add_epi32( current, shifted ), previous );
+            }
+
+            auto message{ _mm_add_epi32( current, _mm_load_si128( reinterpret_cast<const __m128i *>( kRounds + group * 4 ) ) ) };
+
+            cdgh = _mm_sha256rnds2_epu32( cdgh, abef, message );
+            message = _mm_shuffle_epi32( message, 0x0e );
+            abef = _mm_sha256rnds2_epu32( abef, cdgh, message );
+        }
+
+        abef = _mm_add_epi32( abef, savedAbef );
+        cdgh = _mm_add_epi32( cdgh, savedCdgh );
+    }
+
+    temp = _mm_shuffle_epi32( abef, 0x1b );
+    cdgh = _mm_shuffle_epi32( cdgh, 0xb1 );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( state ), _mm_blend_epi16( temp, cdgh, 0xf0 ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>( state + 4 ), _mm_alignr_epi8( cdgh, temp, 8 ) );
+}
+
+void hashShaNi( const char * data,
+                const std::size_t size,
+                char * digest )
+{
+    const auto bytes{ reinterpret_cast<const std::uint8_t *>( data ) };
+    std::uint8_t tail[ kTailSize ];
+    auto state{ kInitial };
+
+    compressShaNi( state.data(), bytes, size / kChunkSize );
+    compressShaNi( state.data(), tail, makeTail( bytes, size, size, tail ) );
+
+    for ( auto i{ 0u }; i < state.size(); ++i )
+    {
+        writeWord( state[ i ], digest + i * sizeof( Word ) );
+    }
+}
+
+__attribute__(( target( "avx2" ) ))
+inline __m256i rotate( const __m256i value,
+                       const int count )
+{
+    return _mm256_or_si256( _mm256_srli_epi32( value, count ),
+                            _mm256_slli_epi32( value, 32 - count ) );
+}
+
+__attribute__(( target( "avx2" ) ))
+void compressAvx2( __m256i * state,
+                   const std::uint8_t * const * chunks )
+{
+    __m256i words[ 16 ];
+    auto a{ state[ 0 ] }, b{ state[ 1 ] }, c{ state[ 2 ] }, d{ state[ 3 ] };
+    auto e{ state[ 4 ] }, f{ state[ 5 ] }, g{ state[ 6 ] }, h{ state[ 7 ] };
+
+    for ( auto round{ 0u }; round < 64; ++round )
+    {
+        auto & word{ words[ round % 16 ] };
+
+        if ( round < 16 )
+        {
+            const auto offset{ round * sizeof( Word ) };
+
+            word = _mm256_setr_epi32( readWord( chunks[ 0 ] + offset ), readWord( chunks[ 1 ] + offset ),
+                                      readWord( chunks[ 2 ] + offset ), readWord( chunks[ 3 ] + offset ),
+                                      readWord( chunks[ 4 ] + offset ), readWord( chunks[ 5 ] + offset ),
+                                      readWord( chunks[ 6 ] + offset ), readWord( chunks[ 7 ] + offset ) );
+        }
+        else
+        {
+            const auto w15{ words[ ( round + 1 ) % 16 ] };
+            const auto w2{ words[ ( round + 14 ) % 16 ] };
+            const auto s0{ _mm256_xor_si256( _mm256_xor_si256( rotate( w15, 7 ), rotate( w15, 18 ) ),
+                                             _mm256_srli_epi32( w15, 3 ) ) };
+            const auto s1{ _mm256_xor_si256( _mm256_xor_si256( rotate( w2, 17 ), rotate( w2, 19 ) ),
+                                             _mm256_srli_epi32( w2, 10 ) ) };
+
+            word = _mm256_add_epi32( _mm256_add_epi32( word, s0 ),
+                                     _mm256_add_epi32( words[ ( round + 9 ) % 16 ], s1 ) );
+        }
+
+        const auto sum1{ _mm256_xor_si256( _mm256_xor_si256( rotate( e, 6 ), rotate( e, 11 ) ), rotate( e, 25 ) ) };
+        const auto choose{ _mm256_xor_si256( _mm256_and_si256( e, f ), _mm256_andnot_si256( e, g ) ) };
+        const auto sum0{ _mm256_xor_si256( _mm256_xor_si256( rotate( a, 2 ), rotate( a, 13 ) ), rotate( a, 22 ) ) };
+        const auto majority{ _mm256_or_si256( _mm256_and_si256( a, b ), _mm256_and_si256( c, _mm256_or_si256( a, b ) ) ) };
+        const auto first{ _mm256_add_epi32( _mm256_add_epi32( h, sum1 ),
+                                            _mm256_add_epi32( _mm256_add_epi32( choose, word ),
+                                                              _mm256_set1_epi32( static_cast<int>( kRounds[ round ] ) ) ) ) };
+        const auto second{ _mm256_add_epi32( sum0, majority ) };
+
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32( d, first );
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32( first, second );
+    }
+
+    state[ 0 ] = _mm256_add_epi32( state[ 0 ], a );
+    state[ 1 ] = _mm256_add_epi32( state[ 1 ], b );
+    state[ 2 ] = _mm256_add_epi32( state[ 2 ], c );
+    state[ 3 ] = _mm256_add_epi32( state[ 3 ], d );
+    state[ 4 ] = _mm256_add_epi32( state[ 4 ], e );
+    state[ 5 ] = _mm256_add_epi32( state[ 5 ], f );
+    state[ 6 ] = _mm256_add_epi32( state[ 6 ], g );
+    state[ 7 ] = _mm256_add_epi32( state[ 7 ], h );
+}
+
+__attribute__(( target( "avx2" ) ))
+void hashAvx2( const Word * initial,
+               const std::uint64_t offset,
+               const char * data,
+               const std::size_t size,
+               const std::size_t stride,
+               char * digests )
+{
+    const auto bytes{ reinterpret_cast<const std::uint8_t *>( data ) };
+    const std::uint8_t * chunks[ Hasher::kLanes ];
+    std::uint8_t tails[ Hasher::kLanes ][ kTailSize ];
+    alignas( 32 ) Word words[ kInitial.size() ][ Hasher::kLanes ];
+    __m256i state[ kInitial.size() ];
+    std::size_t tailChunks{ 0 };
+
+    for ( auto i{ 0u }; i < kInitial.size(); ++i )
+    {
+        state[ i ] = _mm256_set1_epi32( static_cast<int>( initial[ i ] ) );
+    }
+
+    for ( auto chunk{ 0u }; chunk < size / kChunkSize; ++chunk )
+    {
+        for ( auto lane{ 0u }; lane < Hasher::kLanes; ++lane )
+        {
+            chunks[ lane ] = bytes + lane * stride + chunk * kChunkSize;
+        }
+        compressAvx2( state, chunks );
+    }
+
+    for ( auto lane{ 0u }; lane < Hasher::kLanes; ++lane )
+    {
+        tailChunks = makeTail( bytes + lane * stride, size, offset + size, tails[ lane ] );
+    }
+
+    for ( auto chunk{ 0u }; chunk < tailChunks; ++chunk )
+    {
+        for ( auto lane{ 0u }; lane < Hasher::kLanes; ++lane )
+        {
+            chunks[ lane ] = tails[ lane ] + chunk * kChunkSize;
+        }
+        compressAvx2( state, chunks );
+    }
+
+    for ( auto i{ 0u }; i < kInitial.size(); ++i )
+    {
+        _mm256_store_si256( reinterpret_cast<__m256i *>( words[ i ] ), state[ i ] );
+
+        for ( auto lane{ 0u }; lane < Hasher::kLanes; ++lane )
+        {
+            writeWord( words[ i ][ lane ], digests + lane * Hasher::kDigestSize + i * sizeof( Word ) );
+        }
+    }
+}
+
+#endif
+
+Hasher::Backend detectBackend()
+{
+    auto result{ Hasher::Backend::kPortable };
+#ifdef BITCHAT_HASHER_X86
+    unsigned eax{ 0 }, ebx{ 0 }, ecx{ 0 }, edx{ 0 };
+
+    if ( __get_cpuid( 1, & eax, & ebx, & ecx, & edx ) )
+    {
+        const auto sse41{ ( ecx & bit_SSE4_1 ) != 0 && ( ecx & bit_SSSE3 ) != 0 };
+        const auto osxsave{ ( ecx & bit_OSXSAVE ) != 0 && ( ecx & bit_AVX ) != 0 };
+        unsigned xcr0{ 0 }, xcr0High{ 0 };
+
+        if ( osxsave )
+        {
+            //! The operating system must preserve the ymm registers
+            __asm__( "xgetbv" : "=a"( xcr0 ), "=d"( xcr0High ) : "c"( 0 ) );
+        }
+
+        if ( __get_cpuid_count( 7, 0, & eax, & ebx, & ecx, & edx ) )
+        {
+            if ( sse41 && ( ebx & bit_SHA ) != 0 )
+            {
+                result = Hasher::Backend::kShaNi;
+            }
+            else if ( ( xcr0 & 0x6 ) == 0x6 && ( ebx & bit_AVX2 ) != 0 )
+            {
+                result = Hasher::Backend::kAvx2;
+            }
+        }
+    }
+#endif
+    return result;
+}
+
+void compress( Word * state,
+               const std::uint8_t * data,
+               const std::size_t chunks )
+{
+#ifdef BITCHAT_HASHER_X86
+    if ( Hasher::getBackend() == Hasher::Backend::kShaNi )
+    {
+        compressShaNi( state, data, chunks );
+        return;
+    }
+#endif
+    compressPortable( state, data, chunks );
+}
+}
+
+Hasher::Backend Hasher::getBackend()
+{
+    static const auto backend{ detectBackend() };
+    return backend;
+}
+
+const char * Hasher::getBackendName()
+{
+    switch ( getBackend() )
+    {
+    case Backend::kShaNi:
+        return "SHA-NI";
+
+    case Backend::kAvx2:
+        return "AVX2";
+
+    default:
+        return "portable";
+    }
+}
+
+void Hasher::hash( const char * data,
+                   const std::size_t size,
+                   char * digest )
+{
+#ifdef BITCHAT_HASHER_X86
+    if ( getBackend() == Backend::kShaNi )
+    {
+        hashShaNi( data, size, digest );
+        return;
+    }
+#endif
+    hashPortable( data, size, digest );
+}
+
+void Hasher::hash( const char * data,
+                   const std::size_t size,
+                   const std::size_t stride,
+                   const std::size_t count,
+                   char * digests )
+{
+    auto index{ 0ull };
+
+#ifdef BITCHAT_HASHER_X86
+    if ( getBackend() == Backend::kAvx2 )
+    {
+        for ( ; index + kLanes <= count; index += kLanes )
+        {
+            hashAvx2( kInitial.data(), 0, data + index * stride, size, stride, digests + index * kDigestSize );
+        }
+    }
+#endif
+
+    for ( ; index < count; ++index )
+    {
+        hash( data + index * stride, size, digests + index * kDigestSize );
+    }
+}
+
+Hasher::Midstate Hasher::absorb( const char * data,
+                                 const std::size_t size )
+{
+    Midstate result{};
+
+    std::copy( kInitial.begin(), kInitial.end(), result.state );
+    result.size = size - size % kChunkSize;
+    compress( result.state, reinterpret_cast<const std::uint8_t *>( data ), size / kChunkSize );
+
+    return result;
+}
+
+void Hasher::hash( const Midstate & midstate,
+                   const char * data,
+                   const std::size_t size,
+                   char * digest )
+{
+    const auto bytes{ reinterpret_cast<const std::uint8_t *>( data ) };
+    std::uint8_t tail[ kTailSize ];
+    State state{};
+
+    std::copy( std::begin( midstate.state ), std::end( midstate.state ), state.begin() );
+    compress( state.data(), bytes, size / kChunkSize );
+    compress( state.data(), tail, makeTail( bytes, size, midstate.size + size, tail ) );
+
+    for ( auto i{ 0u }; i < state.size(); ++i )
+    {
+        writeWord( state[ i ], digest + i * sizeof( Word ) );
+    }
+}
+
+void Hasher::hash( const Midstate & midstate,
+                   const char * data,
+                   const std::size_t size,
+                   const std::size_t stride,
+                   const std::size_t count,
+                   char * digests )
+{
+    auto index{ 0ull };
+
+#ifdef BITCHAT_HASHER_X86
+    if ( getBackend() == Backend::kAvx2 )
+    {
+        for ( ; index + kLanes <= count; index += kLanes )
+        {
+            hashAvx2( midstate.state, midstate.size, data + index * stride, size, stride, digests + index * kDigestSize );
+        }
+    }
+#endif
+
+    for ( ; index < count; ++index )
+    {
+        hash( midstate, data + index * stride, size, digests + index * kDigestSize );
+    }
+}
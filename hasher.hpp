@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bitchat {
+
+class Hasher
+{
+public:
+    enum class Backend
+    {
+        kPortable,  //! picosha2
+        kShaNi,     //! x86 SHA extensions, one message at a time
+        kAvx2       //! eight messages at a time in AVX2 lanes
+    };
+
+    static constexpr auto kDigestSize{ 32 };
+    static constexpr auto kChunkSize{ 64 };
+    static constexpr auto kLanes{ 8 };
+
+    //! The hash state after the leading whole chunks of a message
+    struct Midstate
+    {
+        std::uint32_t state[ 8 ];
+        std::uint64_t size;
+    };
+
+    Hasher() = delete;
+
+    static Backend getBackend();
+    static const char * getBackendName();
+
+    static void hash( const char * data,
+                      const std::size_t size,
+                      char * digest );
+
+    //! Hashes count messages of the same size laid out stride bytes apart
+    static void hash( const char * data,
+                      const std::size_t size,
+                      const std::size_t stride,
+                      const std::size_t count,
+                      char * digests );
+
+    //! Absorbs the whole chunks of data, the rest must be passed to hash
+    static Midstate absorb( const char * data,
+                            const std::size_t size );
+
+    //! Finishes a message whose last size bytes follow the midstate
+    static void hash( const Midstate & midstate,
+                      const char * data,
+                      const std::size_t size,
+                      char * digest );
+
+    //! Finishes count messages sharing the midstate, their rests laid out stride bytes apart
+    static void hash( const Midstate & midstate,
+                      const char * data,
+                      const std::size_t size,
+                      const std::size_t stride,
+                      const std::size_t count,
+                      char * digests );
+};
+
+} // bitchat
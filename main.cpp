@@ -13,7 +13,19 @@ namespace
 constexpr auto kReconnectInterval{ 1 };
 constexpr auto kOptionHelp{ "help" };
 constexpr auto kOptionServer{ "server" };
-constexpr auto kUsage{ "Usage: %1% [--%2%|--%3% ip:port] \n"
+constexpr auto kOptionVerify{ "verify" };
+constexpr auto kOptionStorage{ "storage" };
+constexpr auto kDefaultStorage{ "ring" };
+constexpr auto kOptionSendQueue{ "send-queue" };
+constexpr std::size_t kDefaultSendQueue{ 4 * 1024 };  //! 4MB
+constexpr auto kOptionDifficulty{ "difficulty" };
+constexpr unsigned kDefaultDifficulty{ 16 };
+constexpr unsigned kMaximumDifficulty{ 255 };  //! stored in a byte of the block
+constexpr auto kOptionArchive{ "archive" };
+constexpr auto kOptionFindKey{ "find-key" };
+constexpr auto kOptionFindRange{ "find-range" };
+constexpr auto kOptionProof{ "proof" };
+constexpr auto kUsage{ "Usage: %1% [--%2%|--%3%|--%4% ip:port|--%9% key|--%10% from:to|--%11% index] [--%5% kind] [--%6% KB] [--%7% bits] [--%8%] \n"
                         "Description" };
 }
 
@@ -28,19 +40,88 @@ int main( int argc,
         po::options_description options{ boost::str( boost::format{ kUsage } %
                                                      app %
                                                      kOptionHelp %
-                                                     kOptionServer ) };
+                                                     kOptionVerify %
+                                                     kOptionServer %
+                                                     kOptionStorage %
+                                                     kOptionSendQueue %
+                                                     kOptionDifficulty %
+                                                     kOptionArchive %
+                                                     kOptionFindKey %
+                                                     kOptionFindRange %
+                                                     kOptionProof ) };
 
         options.add_options()
                 ( kOptionHelp, "print program help" )
-                ( kOptionServer, po::value<std::string>(), "connect to remote server" );
+                ( kOptionVerify, "verify the blockchain integrity and exit" )
+                ( kOptionServer, po::value<std::string>(), "connect to remote server" )
+                ( kOptionFindKey, po::value<std::string>(), "print the indexes of the blocks stored with the key and exit" )
+                ( kOptionFindRange, po::value<std::string>(),
+                  "print the indexes of the blocks stored between the milliseconds since the epoch and exit" )
+                ( kOptionProof, po::value<std::uint64_t>(), "print the root over the blocks and the proof of the block and exit" )
+                ( kOptionStorage, po::value<std::string>()->default_value( kDefaultStorage ),
+                  "keep the blockchain in a stream, mapped, ring or memory storage" )
+                ( kOptionSendQueue, po::value<std::size_t>()->default_value( kDefaultSendQueue ),
+                  "drop a peer which leaves more kilobytes than this unsent" )
+                ( kOptionDifficulty, po::value<unsigned>()->default_value( kDefaultDifficulty ),
+                  "leading zero bits of a mined block hash, 0 appends blocks unmined" )
+                ( kOptionArchive, "compress the blockchain segments once they are full" );
 
         po::store( po::parse_command_line( argc, argv, options), values );
         po::notify( values );
 
+        const auto difficulty{ values[ kOptionDifficulty ].as<unsigned>() };
+
+        if ( difficulty > kMaximumDifficulty )
+        {
+            throw std::invalid_argument( "Invalid difficulty - " + std::to_string( difficulty ) );
+        }
+
         if ( values.count( kOptionHelp ) > 0 )
         {
             std::cout << options << std::endl;
         }
+        else if ( values.count( kOptionVerify ) > 0 )
+        {
+            if ( ! bitchat::Application::verify( app, static_cast<std::uint8_t>( difficulty ) ) )
+            {
+                result = 3;
+            }
+        }
+        else if ( values.count( kOptionFindKey ) > 0 )
+        {
+            for ( const auto index : bitchat::Application::findKey( app, values[ kOptionFindKey ].as<std::string>() ) )
+            {
+                std::cout << index << std::endl;
+            }
+        }
+        else if ( values.count( kOptionFindRange ) > 0 )
+        {
+            const auto range{ values[ kOptionFindRange ].as<std::string>() };
+            const auto idx{ range.find( ':' ) };
+
+            if ( idx == std::string::npos )
+            {
+                throw std::invalid_argument( "Invalid range - " + range );
+            }
+
+            for ( const auto index : bitchat::Application::findRange( app, std::stoll( range.substr( 0, idx ) ),
+                                                                      std::stoll( range.substr( idx + 1 ) ) ) )
+            {
+                std::cout << index << std::endl;
+            }
+        }
+        else if ( values.count( kOptionProof ) > 0 )
+        {
+            std::string root{};
+            std::string proof{};
+
+            if ( ! bitchat::Application::prove( app, values[ kOptionProof ].as<std::uint64_t>(), root, proof ) )
+            {
+                result = 3;
+            }
+
+            std::cout << root << std::endl << proof << std::endl;
+        }
         else
         {
             auto host{ app };
@@ -68,7 +149,11 @@ int main( int argc,
                 }
             }
 
-            bitchat::Application::run( app, host, port, kReconnectInterval );
+            bitchat::Application::run( app, host, port, kReconnectInterval,
+                                       values[ kOptionStorage ].as<std::string>(),
+                                       values[ kOptionSendQueue ].as<std::size_t>() * 1024,
+                                       static_cast<std::uint8_t>( difficulty ),
+                                       values.count( kOptionArchive ) > 0 );
         }
     }
     catch ( const std::runtime_error & exception )
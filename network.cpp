@@ -12,19 +12,21 @@ using bitchat::Network;
 Network::Network( const std::shared_ptr<Communication> & communication,
                   const std::string & ip,
                   const std::uint16_t port,
-                  const int reconnectInterval ) :
+                  const int reconnectInterval,
+                  const std::size_t highWaterMark ) :
     m_ip{ ip },
     m_port{ port },
+    m_highWaterMark{ highWaterMark },
     m_acceptor{ communication->getIos() },
     m_timer{ m_acceptor.get_io_service() },
     m_reconnectInterval{ boost::posix_time::seconds{ reconnectInterval } }
 {
-    std::make_shared<SocketChannel>( communication ).swap( m_server );
+    std::make_shared<SocketChannel>( communication, m_highWaterMark ).swap( m_server );
 }
 
 void Network::open()
 {
-    const auto channel{ std::make_shared<SocketChannel>( m_server->getCommunication() ) };
+    const auto channel{ std::make_shared<SocketChannel>( m_server->getCommunication(), m_highWaterMark ) };
 
     if ( ! m_acceptor.is_open() )
     {
@@ -19,7 +19,8 @@ public:
     explicit Network( const std::shared_ptr<Communication> & communication,
                       const std::string & ip,
                       const std::uint16_t port,
-                      const int reconnectInterval );
+                      const int reconnectInterval,
+                      const std::size_t highWaterMark );
 
     void open();
     void close();
@@ -39,6 +40,7 @@ protected:
 private:
     const std::string m_ip;
     const std::uint16_t m_port;
+    const std::size_t m_highWaterMark;  //! of the send queue of every peer
     Tcp::acceptor m_acceptor;
     boost::asio::deadline_timer m_timer;
     boost::posix_time::time_duration m_reconnectInterval;
@@ -9,15 +9,30 @@
 
 using bitchat::SocketChannel;
 
-SocketChannel::SocketChannel( const CommunicationPtr & communication ) :
+constexpr std::size_t SocketChannel::kHighWaterMark;
+
+SocketChannel::SocketChannel( const CommunicationPtr & communication,
+                              const std::size_t highWaterMark ) :
     Tcp::socket{ communication->getIos() },
-    m_communication{ communication }
+    m_communication{ communication },
+    m_highWaterMark{ highWaterMark },
+    m_strand{ communication->getIos() },
+    m_queuedSize{ 0 },
+    m_writing{ false },
+    m_overflowed{ false }
 {
 }
 
 void SocketChannel::open()
 {
     BOOST_ASSERT( isOpen() );
+
+    do
+    {
+        std::lock_guard<std::mutex> lock{ m_sendMutex };
+        m_overflowed = false;
+    } while( false );
+
     getCommunication()->notify( kOnOpen, this );
 }
 
@@ -41,20 +56,20 @@ bitchat::Channel::CommunicationPtr & SocketChannel::getCommunication()
 std::string SocketChannel::read( std::size_t size )
 {
     std::string result{};
-    boost::asio::streambuf stream{};
-    auto readed{ 0ull };
 
     if ( size == 0 )
     {
-        readed = boost::asio::read_until( * this, stream, kEndLine );
+        boost::asio::read_until( * this, m_line, kEndLine );
     }
     else
     {
+        //! Binary messages are read exactly, they may hold the end of line byte
         result.resize( size );
-        readed = boost::asio::read( * this, stream );
+        boost::asio::read( * this, boost::asio::buffer( & result.front(), size ) );
+        return result;
     }
 
-    std::istream input{ & stream };
+    std::istream input{ & m_line };
     std::getline( input, result );
 
     return result;
@@ -65,6 +80,93 @@ void SocketChannel::write( const std::string & data )
     boost::asio::write( * this, boost::asio::buffer( data ) );
 }
 
+void SocketChannel::readFrames( const FrameHandler & handler )
+{
+    char tag{ 0 };
+    std::string payload{};
+
+    try
+    {
+        while ( m_frames.next( tag, payload ) )
+        {
+            if ( ! handler( boost::system::error_code{}, tag, payload ) )
+            {
+                return;
+            }
+        }
+    }
+    catch ( const boost::system::system_error & error )
+    {
+        handler( error.code(), 0, std::string{} );
+        return;
+    }
+
+    //! The handler owns the channel while the read is pending, the read and the writes
+    //! of the channel never start at once
+    m_strand.dispatch( [ this, handler ] {
+        async_read_some( m_frames.prepare(), m_strand.wrap( [ this, handler ](
+                         const boost::system::error_code & error, const std::size_t size ) {
+            if ( error )
+            {
+                handler( error, 0, std::string{} );
+                return;
+            }
+
+            m_frames.commit( size );
+            readFrames( handler );
+        } ) );
+    } );
+}
+
+void SocketChannel::writeFrame( std::string message )
+{
+    writeFrame( std::move( message ), nullptr, 0 );
+}
+
+void SocketChannel::writeFrame( std::string message,
+                                std::shared_ptr<const char> data,
+                                const std::size_t length )
+{
+    BOOST_ASSERT( ! message.empty() && ( data != nullptr || length == 0 ) );
+    const auto size{ FrameBuffer::kHeaderSize + message.size() - 1 + length };
+    std::lock_guard<std::mutex> lock{ m_sendMutex };
+
+    if ( ! isOpen() || m_overflowed )
+    {
+        return;
+    }
+
+    //! A message longer than the mark still goes out when nothing else is waiting
+    if ( m_queuedSize > 0 && m_queuedSize + size > m_highWaterMark )
+    {
+        const auto self{ shared_from_this() };
+
+        m_overflowed = true;
+        BOOST_LOG_TRIVIAL( warning ) << "Closing a peer which has " << m_queuedSize << " bytes unsent";
+        m_strand.post( [ self ] {
+            if ( self->isOpen() )
+            {
+                self->close();
+            }
+        } );
+        return;
+    }
+
+    m_queued.push_back( Frame{ std::move( message ), std::move( data ), length } );
+    m_queuedSize += size;
+
+    if ( ! m_writing )
+    {
+        const auto self{ shared_from_this() };
+
+        m_writing = true;
+        m_strand.post( [ self ] {
+            std::lock_guard<std::mutex> lock{ self->m_sendMutex };
+            self->sendFrames();
+        } );
+    }
+}
+
 std::string SocketChannel::getLocalAddress()
 {
     return makeEndpointAddress( local_endpoint() );
@@ -75,6 +177,55 @@ std::string SocketChannel::getRemoteAddress()
     return makeEndpointAddress( remote_endpoint() );
 }
 
+void SocketChannel::sendFrames()
+{
+    //! Expects m_sendMutex to be locked by the caller, on the strand
+    const auto self{ shared_from_this() };
+    Buffers buffers{};
+
+    m_sending.swap( m_queued );
+    m_headers.resize( m_sending.size() );
+    buffers.reserve( m_sending.size() * 3 );
+
+    for ( auto i{ 0ull }; i < m_sending.size(); ++i )
+    {
+        const auto & frame{ m_sending[ i ] };
+
+        FrameBuffer::encodeHeader( frame.message.front(), frame.message.size() - 1 + frame.size, m_headers[ i ].data() );
+        buffers.emplace_back( boost::asio::buffer( m_headers[ i ] ) );
+        buffers.emplace_back( boost::asio::buffer( frame.message.data() + 1, frame.message.size() - 1 ) );
+
+        if ( frame.size > 0 )
+        {
+            buffers.emplace_back( boost::asio::buffer( frame.data.get(), frame.size ) );
+        }
+    }
+
+    boost::asio::async_write( * this, buffers, m_strand.wrap( [ self ]( const boost::system::error_code & error,
+                                                                        const std::size_t size ) {
+        std::lock_guard<std::mutex> lock{ self->m_sendMutex };
+
+        self->m_sending.clear();
+        self->m_queuedSize -= size;
+
+        if ( error )
+        {
+            //! The reading side of the channel reports the peer as lost
+            self->m_queued.clear();
+            self->m_queuedSize = 0;
+            self->m_writing = false;
+        }
+        else if ( ! self->m_queued.empty() )
+        {
+            self->sendFrames();
+        }
+        else
+        {
+            self->m_writing = false;
+        }
+    } ) );
+}
+
 std::string SocketChannel::makeEndpointAddress( const Tcp::endpoint & endpoint )
 {
     std::string result{ endpoint.address().to_string() };
@@ -1,18 +1,44 @@
 #pragma once
 
 #include "channel.hpp"
+#include "framebuffer.hpp"
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
+#include <functional>
+#include <vector>
+#include <array>
+#include <mutex>
 
 namespace bitchat {
 
 class SocketChannel :
         virtual public Channel,
-        public boost::asio::ip::tcp::socket
+        public boost::asio::ip::tcp::socket,
+        public std::enable_shared_from_this<SocketChannel>
 {
     using Tcp = boost::asio::ip::tcp;
+    using Header = std::array<char, FrameBuffer::kHeaderSize>;
+    using Buffers = std::vector<boost::asio::const_buffer>;
+
+    struct Frame
+    {
+        std::string message;
+        std::shared_ptr<const char> data;   //! the bytes after the payload of the message
+        std::size_t size;
+    };
 
 public:
-    explicit SocketChannel( const CommunicationPtr & communication );
+    //! Returns whether to go on reading, it gets the error the reading stopped on instead of a frame
+    using FrameHandler = std::function<bool ( const boost::system::error_code & error,
+                                              const char tag,
+                                              const std::string & payload )>;
+
+    static constexpr std::size_t kHighWaterMark{ 4 * 1024 * 1024 };  //! 4MB
+
+    explicit SocketChannel( const CommunicationPtr & communication,
+                            const std::size_t highWaterMark = kHighWaterMark );
 
     void open() override;
     void close() override;
@@ -23,14 +49,42 @@ public:
     std::string read( std::size_t size ) override;
     void write( const std::string & data ) override;
 
+    //! Reads the frames until the handler stops it, one socket read gives out every frame
+    //! it completed. A channel read by frames must not be read otherwise, its buffer
+    //! holds the bytes of the frames to come. The reads start on the strand of the channel
+    //! and the handler runs there
+    void readFrames( const FrameHandler & handler );
+    //! Queues a message, its tag and the payload after it, to be sent as a frame and returns
+    //! at once. The frames queued meanwhile go out together in one write, a peer which lets
+    //! more than the high-water mark pile up is closed. A channel sending frames must not
+    //! be written otherwise. The write starts on the strand of the channel
+    void writeFrame( std::string message );
+    //! Queues the message with size bytes of data after its payload as one frame, the data
+    //! goes out from where it is and is held until then
+    void writeFrame( std::string message,
+                     std::shared_ptr<const char> data,
+                     const std::size_t size );
+
     std::string getLocalAddress();
     std::string getRemoteAddress();
 
 private:
     std::string makeEndpointAddress( const Tcp::endpoint & endpoint );
+    void sendFrames();
 
 private:
     CommunicationPtr m_communication;
+    const std::size_t m_highWaterMark;
+    boost::asio::io_service::strand m_strand;  //! the socket operations of the frames start on it
+    std::mutex m_sendMutex;
+    std::vector<Frame> m_queued;    //! the frames waiting for the write in flight
+    std::vector<Frame> m_sending;   //! the frames of the write in flight
+    std::vector<Header> m_headers;          //! the frame headers of the write in flight
+    std::size_t m_queuedSize;               //! the bytes of both, in frames
+    bool m_writing;
+    bool m_overflowed;                      //! the channel is being closed for a full queue
+    boost::asio::streambuf m_line;  //! keeps what was read past the end of a line
+    FrameBuffer m_frames;
 };
 
 } // bitchat